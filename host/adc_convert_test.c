@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Checks the integer and single precision conversions of adc_convert against
+// double precision references, over every sample of every slot precision.
+
+#include <adc_convert.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Results are rounded to the nearest mV, allow for ties of the reference
+#define MILLIVOLTS_TOLERANCE (0.5 + 1e-9)
+#define CELSIUS_TOLERANCE 1e-4
+
+// Temperatures the die sensor is checked over, in degrees C
+#define CELSIUS_MIN -40.0
+#define CELSIUS_MAX 125.0
+
+// FIFO words hold the sample in bits 0 to 19, with 6 fractional bits, and
+// the slot in bits 28 to 30
+#define FIFO_FRACTION_BITS 6
+#define FIFO_SLOT_SHIFT 28
+
+struct result
+{
+	const char *name;
+	double max_error;
+	double tolerance;
+	uint64_t checked;
+	uint64_t failed;
+};
+
+static void check(struct result *result, double value, double reference)
+{
+	const double error = fabs(value - reference);
+	if (error > result->max_error)
+		result->max_error = error;
+	if (!(error <= result->tolerance))
+		result->failed += 1;
+	result->checked += 1;
+}
+
+static bool report(const struct result *result)
+{
+	printf(
+		"%-28s %9llu checked, max error %.3g (tolerance %.3g), %llu failed\n",
+		result->name,
+		(unsigned long long)result->checked,
+		result->max_error,
+		result->tolerance,
+		(unsigned long long)result->failed
+	);
+	return result->checked && !result->failed;
+}
+
+static double max_count(uint8_t precision)
+{
+	return (double)((UINT32_C(1) << precision) - 1);
+}
+
+static void test_millivolts(
+	struct result *result, uint8_t precision, uint32_t reference_mv
+)
+{
+	const uint32_t max = (UINT32_C(1) << precision) - 1;
+	for (uint32_t sample = 0; sample <= max; ++sample)
+	{
+		const double reference =
+			sample * (double)reference_mv / max_count(precision);
+		check(
+			result,
+			adc_convert_millivolts(sample, precision, reference_mv),
+			reference
+		);
+	}
+}
+
+static void test_millivolts_bulk(
+	struct result *result, uint8_t precision, uint32_t reference_mv
+)
+{
+	// Every fractional FIFO value in range, in chunks, with slot bits set to
+	// check they are ignored
+	static uint32_t words[1024];
+	static uint32_t millivolts[1024];
+	const uint32_t end = ((UINT32_C(1) << precision) - 1)
+		<< FIFO_FRACTION_BITS;
+	for (uint32_t first = 0; first <= end; first += 1024)
+	{
+		size_t count = 0;
+		for (uint32_t data = first; data <= end && count < 1024; ++data)
+		{
+			words[count] = (uint32_t)(count % 8) << FIFO_SLOT_SHIFT | data;
+			count += 1;
+		}
+		adc_convert_millivolts_bulk(
+			words, millivolts, count, precision, reference_mv
+		);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const double data = first + i;
+			const double reference = data / (1 << FIFO_FRACTION_BITS) *
+				reference_mv / max_count(precision);
+			check(result, millivolts[i], reference);
+		}
+	}
+}
+
+static void test_battery(
+	struct result *result, uint8_t precision, uint32_t reference_mv
+)
+{
+	const uint32_t max = (UINT32_C(1) << precision) - 1;
+	for (uint32_t sample = 0; sample <= max; ++sample)
+	{
+		const double reference =
+			sample * (double)reference_mv * 3.0 / max_count(precision);
+		check(
+			result,
+			adc_convert_battery_millivolts(sample, precision, reference_mv),
+			reference
+		);
+	}
+}
+
+static void test_differential(
+	struct result *result, uint8_t precision, uint32_t reference_mv
+)
+{
+	// Every two's complement code, positive and negative
+	const uint32_t codes = UINT32_C(1) << precision;
+	const double max = max_count(precision - 1);
+	for (uint32_t code = 0; code < codes; ++code)
+	{
+		const int32_t sample = adc_convert_signed(code, precision);
+		const int32_t expected =
+			code < codes / 2 ? (int32_t)code : (int32_t)code - (int32_t)codes;
+		if (sample != expected)
+		{
+			result->failed += 1;
+			continue;
+		}
+		check(
+			result,
+			adc_convert_differential_millivolts(
+				sample, precision, reference_mv
+			),
+			sample * (double)reference_mv / max
+		);
+	}
+}
+
+static void test_celsius(
+	struct result *result,
+	const struct adc_convert_temperature_trims *trims,
+	uint8_t precision,
+	uint32_t reference_mv
+)
+{
+	struct adc_convert_temperature_curve curve;
+	adc_convert_temperature_curve(&curve, trims, precision, reference_mv);
+
+	const double calibration_kelvin = trims->calibration_kelvin;
+	const double calibration_volts = trims->calibration_volts;
+	const double offset_volts = trims->offset_volts;
+	const uint32_t max = (UINT32_C(1) << precision) - 1;
+	for (uint32_t sample = 0; sample <= max; ++sample)
+	{
+		// The formula the HAL uses, in double precision
+		const double volts =
+			sample * (reference_mv / 1000.0) / max_count(precision);
+		const double reference = calibration_kelvin *
+				(volts - offset_volts) / (calibration_volts - offset_volts) -
+			273.15;
+		if (reference < CELSIUS_MIN || reference > CELSIUS_MAX)
+			continue;
+		check(result, adc_convert_celsius(&curve, sample), reference);
+	}
+}
+
+int main(void)
+{
+	static const uint8_t precisions[] = {8, 10, 12, 14};
+	static const uint32_t references[] = {1500, ADC_CONVERT_REFERENCE_MV};
+	const struct adc_convert_temperature_trims trims[] = {
+		ADC_CONVERT_TEMPERATURE_TRIMS_DEFAULT,
+		// A calibrated part, with trims in the range the HAL accepts
+		{.calibration_kelvin = 298.15f,
+		 .calibration_volts = 0.9912f,
+		 .offset_volts = 0.0021f},
+	};
+
+	struct result millivolts = {"millivolts", 0, MILLIVOLTS_TOLERANCE, 0, 0};
+	struct result bulk = {"millivolts bulk (FIFO)", 0, MILLIVOLTS_TOLERANCE,
+		0, 0};
+	struct result battery = {"battery millivolts", 0, MILLIVOLTS_TOLERANCE,
+		0, 0};
+	struct result differential = {"differential millivolts", 0,
+		MILLIVOLTS_TOLERANCE, 0, 0};
+	struct result celsius = {"die temperature", 0, CELSIUS_TOLERANCE, 0, 0};
+
+	for (size_t i = 0; i < sizeof(precisions) / sizeof(*precisions); ++i)
+	{
+		for (size_t j = 0; j < sizeof(references) / sizeof(*references); ++j)
+		{
+			test_millivolts(&millivolts, precisions[i], references[j]);
+			test_millivolts_bulk(&bulk, precisions[i], references[j]);
+			test_battery(&battery, precisions[i], references[j]);
+			test_differential(&differential, precisions[i], references[j]);
+			for (size_t k = 0; k < sizeof(trims) / sizeof(*trims); ++k)
+			{
+				test_celsius(
+					&celsius, &trims[k], precisions[i], references[j]
+				);
+			}
+		}
+	}
+
+	bool passed = report(&millivolts);
+	passed &= report(&bulk);
+	passed &= report(&battery);
+	passed &= report(&differential);
+	passed &= report(&celsius);
+	return passed ? 0 : 1;
+}
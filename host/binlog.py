@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+"""Formats records logged with BINLOG (see binlog.h) on the host.
+
+  binlog.py extract <elf> <table>
+    Copies the format strings (the .binlog section) out of the ELF. The build
+    does this for the example executable.
+
+  binlog.py decode <table or elf> [records]
+    Formats the records read from a file (default stdin), written either by
+    binlog_sink_fd, or by binlog_sink_telemetry and demultiplexed by
+    telemetry_decode.
+"""
+
+import re
+import struct
+import sys
+
+SECTION = '.binlog'
+
+# printf conversions, with the length modifiers dropped since every argument
+# is a 32 bit word
+CONVERSION = re.compile(
+    r'%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(?:hh|h|ll|l|j|z|t|L)?([diouxXcp%])'
+)
+
+
+def read_section(elf, name):
+    """Returns the contents of the named section of an ELF, or an empty table
+    if there is no such section (nothing was logged)."""
+    if elf[:4] != b'\x7fELF':
+        raise ValueError('not an ELF file')
+    is_64 = elf[4] == 2
+    endian = '<' if elf[5] == 1 else '>'
+    if is_64:
+        shoff, = struct.unpack_from(endian + 'Q', elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(
+            endian + 'HHH', elf, 0x3A)
+        layout = endian + 'IIQQQQ'
+    else:
+        shoff, = struct.unpack_from(endian + 'I', elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(
+            endian + 'HHH', elf, 0x2E)
+        layout = endian + 'IIIIII'
+
+    def header(index):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from(layout, elf, shoff + index * shentsize)
+
+    strtab = header(shstrndx)
+    names = elf[strtab[4]:strtab[4] + strtab[5]]
+    for index in range(shnum):
+        section = header(index)
+        end = names.index(b'\0', section[0])
+        if names[section[0]:end].decode() == name:
+            return elf[section[4]:section[4] + section[5]]
+    return b''
+
+
+def load_table(path):
+    with open(path, 'rb') as file:
+        data = file.read()
+    if data[:4] == b'\x7fELF':
+        return read_section(data, SECTION)
+    return data
+
+
+def format_string(table, offset):
+    end = table.find(b'\0', offset)
+    if offset >= len(table) or end < 0:
+        return None
+    return table[offset:end].decode(errors='replace')
+
+
+def format_record(fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        if width == '*':
+            width = str(args.pop(0)) if args else ''
+        value = args.pop(0) if args else 0
+        if conversion in 'di':
+            value = value - (1 << 32) if value & 0x80000000 else value
+        elif conversion == 'c':
+            value = chr(value & 0xFF)
+        elif conversion == 'p':
+            conversion = 'x'
+            flags = flags + '#'
+        elif conversion == 'u':
+            conversion = 'd'
+        spec = '%' + flags + (width or '')
+        if precision is not None and conversion != 'c':
+            spec += '.' + precision
+        return (spec + conversion) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(table, stream, out):
+    while True:
+        header = stream.read(4)
+        if len(header) < 4:
+            return
+        header, = struct.unpack('<I', header)
+        if not header & 0x80000000:
+            out.write('bad record header 0x%08x, giving up\n' % header)
+            return
+        count = (header >> 24) & 0x7
+        words = stream.read(4 * (1 + count))
+        if len(words) < 4 * (1 + count):
+            return
+        timestamp, *args = struct.unpack('<%dI' % (1 + count), words)
+        fmt = format_string(table, header & 0xFFFFFF)
+        if fmt is None:
+            text = 'unknown format 0x%06x %s' % (
+                header & 0xFFFFFF, ' '.join('0x%08x' % arg for arg in args))
+        else:
+            text = format_record(fmt, args).rstrip('\r\n')
+        out.write('[%10.3f] %s\n' % (timestamp / 1000, text))
+
+
+def main(argv):
+    if len(argv) == 4 and argv[1] == 'extract':
+        with open(argv[2], 'rb') as file:
+            table = read_section(file.read(), SECTION)
+        with open(argv[3], 'wb') as file:
+            file.write(table)
+        return 0
+    if len(argv) in (3, 4) and argv[1] == 'decode':
+        table = load_table(argv[2])
+        if len(argv) == 4:
+            with open(argv[3], 'rb') as stream:
+                decode(table, stream, sys.stdout)
+        else:
+            decode(table, sys.stdin.buffer, sys.stdout)
+        return 0
+    sys.stderr.write(__doc__)
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// For ftruncate and mmap with -std=c2x
+#define _POSIX_C_SOURCE 200809L
+
+#include "flash_emulator.h"
+
+#include <flash.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same defaults as the driver, so the emulated chip looks like the one the
+// library was written for
+static const struct flash_info default_info = {
+	.jedec_id = 0xEF4015,
+	.sfdp = false,
+	.size = 512 * 4096,
+	.page_size = 256,
+	.page_program_us = 700,
+	.chip_erase_ms = 0,
+	.erase =
+		{
+			{.size = 4096, .opcode = 0x20, .typical_ms = 45},
+		},
+	.read = {.opcode = 0x03, .dummy_clocks = 0, .mode_clocks = 0},
+};
+
+// Typical numbers from W25Q-class datasheets
+static const struct flash_emulator_timing default_timing = {
+	.spi_clock = 12000000,
+	.page_program_us = 700,
+	.sector_erase_us = 45000,
+};
+
+struct flash_emulator
+{
+	int fd;
+	uint8_t *memory;
+	struct flash_info info;
+	struct flash_emulator_timing timing;
+	struct flash_emulator_stats stats;
+	uint32_t *wear;
+	uint32_t blocks;
+	// Simulated clock and the time the current program/erase completes, in
+	// nanoseconds
+	uint64_t now_ns;
+	uint64_t busy_until_ns;
+	bool write_enabled;
+};
+
+static struct flash_emulator emulator = {
+	.fd = -1,
+};
+
+// Charges the bus time of one transaction of the given number of bytes
+static void bus_transaction(uint32_t bytes)
+{
+	uint64_t ns = (uint64_t)bytes * 8 * 1000000000u / emulator.timing.spi_clock;
+	emulator.now_ns += ns;
+	emulator.stats.transactions += 1;
+}
+
+static bool busy(void)
+{
+	return emulator.now_ns < emulator.busy_until_ns;
+}
+
+bool flash_emulator_open(
+	const char *path,
+	const struct flash_info *info,
+	const struct flash_emulator_timing *timing
+)
+{
+	if (emulator.fd >= 0)
+		flash_emulator_close();
+
+	emulator.info = info ? *info : default_info;
+	emulator.timing = timing ? *timing : default_timing;
+	uint32_t size = emulator.info.size;
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+		((uint64_t)st.st_size < size && ftruncate(fd, size) != 0))
+	{
+		close(fd);
+		return false;
+	}
+
+	uint8_t *memory =
+		mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (memory == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	// Anything the file didn't cover before is erased flash
+	if ((uint64_t)st.st_size < size)
+		memset(memory + st.st_size, 0xFF, size - st.st_size);
+
+	emulator.blocks = size / emulator.info.erase[0].size;
+	emulator.wear = calloc(emulator.blocks, sizeof(*emulator.wear));
+	if (!emulator.wear)
+	{
+		munmap(memory, size);
+		close(fd);
+		return false;
+	}
+
+	emulator.fd = fd;
+	emulator.memory = memory;
+	emulator.now_ns = 0;
+	emulator.busy_until_ns = 0;
+	emulator.write_enabled = false;
+	memset(&emulator.stats, 0, sizeof(emulator.stats));
+	return true;
+}
+
+void flash_emulator_close(void)
+{
+	if (emulator.fd < 0)
+		return;
+	munmap(emulator.memory, emulator.info.size);
+	close(emulator.fd);
+	free(emulator.wear);
+	emulator.fd = -1;
+	emulator.memory = NULL;
+	emulator.wear = NULL;
+}
+
+const struct flash_emulator_stats *flash_emulator_stats(void)
+{
+	emulator.stats.time_us = emulator.now_ns / 1000;
+	return &emulator.stats;
+}
+
+const uint32_t *flash_emulator_wear(uint32_t *count)
+{
+	*count = emulator.blocks;
+	return emulator.wear;
+}
+
+void flash_emulator_reset_stats(void)
+{
+	memset(&emulator.stats, 0, sizeof(emulator.stats));
+	memset(emulator.wear, 0, emulator.blocks * sizeof(*emulator.wear));
+	// Keep the clock monotonic for the busy tracking, but start the reported
+	// time from here
+	emulator.busy_until_ns -= emulator.busy_until_ns > emulator.now_ns
+		? emulator.now_ns
+		: emulator.busy_until_ns;
+	emulator.now_ns = 0;
+}
+
+void flash_init(struct flash *flash, struct spi_device *device)
+{
+	flash->spi = device;
+	flash->mspi = NULL;
+	flash->quad = false;
+	flash->info = default_info;
+}
+
+void flash_init_mspi(struct flash *flash, struct mspi *mspi)
+{
+	flash->spi = NULL;
+	flash->mspi = mspi;
+	flash->quad = false;
+	flash->info = default_info;
+}
+
+bool flash_detect(struct flash *flash)
+{
+	flash->info = emulator.info;
+	flash->info.jedec_id = flash_read_id(flash);
+	return flash->info.sfdp;
+}
+
+void flash_read_sfdp(
+	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
+)
+{
+	(void)flash;
+	(void)addr;
+	// No SFDP table, an unprogrammed area reads back as erased
+	bus_transaction(5 + size);
+	memset(buffer, 0xFF, size);
+}
+
+uint8_t flash_read_status_register(struct flash *flash)
+{
+	(void)flash;
+	bus_transaction(2);
+	emulator.stats.status_reads += 1;
+	return (busy() ? 0x01 : 0x00) | (emulator.write_enabled ? 0x02 : 0x00);
+}
+
+void flash_wait_busy(struct flash *flash)
+{
+	(void)flash;
+	// The driver holds CS and keeps clocking out the status register, so this
+	// is a single transaction with one status byte per poll
+	uint64_t byte_ns = 8 * 1000000000ull / emulator.timing.spi_clock;
+	uint64_t polls = 1;
+	if (busy())
+	{
+		polls += (emulator.busy_until_ns - emulator.now_ns) / byte_ns + 1;
+		emulator.now_ns = emulator.busy_until_ns;
+	}
+	// Command byte, and the read that releases CS
+	bus_transaction(2);
+	emulator.stats.status_reads += polls;
+}
+
+void flash_write_enable(struct flash *flash)
+{
+	(void)flash;
+	bus_transaction(1);
+	// Chips ignore everything but status reads while busy
+	if (busy())
+	{
+		emulator.stats.rejected += 1;
+		return;
+	}
+	emulator.write_enabled = true;
+}
+
+uint8_t flash_read_data(
+	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
+)
+{
+	bus_transaction(4 + flash->info.read.dummy_clocks / 8 + size);
+	emulator.stats.reads += 1;
+	emulator.stats.read_bytes += size;
+	// The bus floats if the chip is busy, make it obvious
+	if (busy())
+	{
+		emulator.stats.rejected += 1;
+		memset(buffer, 0xFF, size);
+		return 1;
+	}
+	for (uint32_t i = 0; i < size; ++i)
+		buffer[i] = emulator.memory[(addr + i) % emulator.info.size];
+	return 1;
+}
+
+uint8_t flash_page_program(
+	struct flash *flash, uint32_t addr, const uint8_t *buffer, uint32_t size
+)
+{
+	// Same write enable check as the driver
+	flash_write_enable(flash);
+	if (!(flash_read_status_register(flash) & 0x02))
+		return 0;
+
+	bus_transaction(4 + size);
+	if (busy())
+	{
+		emulator.stats.rejected += 1;
+		return 0;
+	}
+
+	// Programming can only clear bits, and wraps around within the page
+	uint32_t page_size = emulator.info.page_size;
+	uint32_t page = (addr % emulator.info.size) & ~(page_size - 1);
+	uint32_t offset = addr & (page_size - 1);
+	for (uint32_t i = 0; i < size; ++i)
+		emulator.memory[page + (offset + i) % page_size] &= buffer[i];
+
+	// A short program still pays the setup cost, then scales with the bytes
+	uint64_t us = emulator.timing.page_program_us;
+	uint64_t setup_us = us / 8;
+	uint32_t bytes = size < page_size ? size : page_size;
+	us = setup_us + (us - setup_us) * bytes / page_size;
+	emulator.busy_until_ns = emulator.now_ns + us * 1000;
+	emulator.write_enabled = false;
+	emulator.stats.programs += 1;
+	emulator.stats.program_bytes += size;
+	return 1;
+}
+
+static uint8_t erase(struct flash *flash, uint32_t addr, uint32_t size)
+{
+	flash_write_enable(flash);
+	if (!(flash_read_status_register(flash) & 0x02))
+		return 0;
+
+	bus_transaction(4);
+	if (busy())
+	{
+		emulator.stats.rejected += 1;
+		return 0;
+	}
+
+	uint32_t start = (addr % emulator.info.size) & ~(size - 1);
+	memset(emulator.memory + start, 0xFF, size);
+	uint32_t block_size = emulator.info.erase[0].size;
+	for (uint32_t block = start / block_size;
+		 block < (start + size) / block_size;
+		 ++block)
+		emulator.wear[block] += 1;
+
+	uint64_t us = (uint64_t)emulator.timing.sector_erase_us * size / block_size;
+	emulator.busy_until_ns = emulator.now_ns + us * 1000;
+	emulator.write_enabled = false;
+	emulator.stats.erases += 1;
+	return 1;
+}
+
+uint8_t flash_sector_erase(struct flash *flash, uint32_t addr)
+{
+	return erase(flash, addr, emulator.info.erase[0].size);
+}
+
+uint8_t flash_erase(struct flash *flash, uint32_t addr, uint32_t size)
+{
+	const struct flash_erase_type *types = emulator.info.erase;
+	for (size_t i = 0; i < 4 && types[i].size; ++i)
+	{
+		if (types[i].size == size)
+			return erase(flash, addr, size);
+	}
+	return 0;
+}
+
+uint32_t flash_read_id(struct flash *flash)
+{
+	(void)flash;
+	bus_transaction(4);
+	return emulator.info.jedec_id;
+}
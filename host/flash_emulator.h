@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef FLASH_EMULATOR_H_
+#define FLASH_EMULATOR_H_
+
+#include <flash.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Timings of the emulated flash chip. */
+struct flash_emulator_timing
+{
+	/** SPI clock in Hz, used to charge bus time for every transaction. */
+	uint32_t spi_clock;
+	/** Time a page program keeps the chip busy, in microseconds. */
+	uint32_t page_program_us;
+	/** Time a sector (erase[0]) erase keeps the chip busy, in microseconds.
+	 * Larger erases scale with their size. */
+	uint32_t sector_erase_us;
+};
+
+/** Counters collected by the emulator since it was opened or last reset. */
+struct flash_emulator_stats
+{
+	/** Simulated time spent on the bus and waiting on the chip, in
+	 * microseconds. */
+	uint64_t time_us;
+	/** Number of SPI transactions, counting a held-CS sequence as one. */
+	uint64_t transactions;
+	/** Number of data read commands. */
+	uint64_t reads;
+	/** Bytes returned by data read commands. */
+	uint64_t read_bytes;
+	/** Number of page program commands accepted. */
+	uint64_t programs;
+	/** Bytes programmed by the page program commands. */
+	uint64_t program_bytes;
+	/** Number of erase commands accepted, of any size. */
+	uint64_t erases;
+	/** Number of status register reads. */
+	uint64_t status_reads;
+	/** Number of commands rejected because write enable wasn't set, or the
+	 * chip was still busy. */
+	uint64_t rejected;
+};
+
+/** Opens the emulated flash chip.
+ *
+ * The chip contents are kept in a file mapped into memory, so they survive
+ * between runs. A new or short file is grown to the chip size and filled with
+ * 0xFF, like an erased chip.
+ *
+ * There is a single emulated chip, used by every flash_* function regardless
+ * of the struct flash passed in. flash_init and flash_detect still need to be
+ * called to fill in flash->info.
+ *
+ * @param[in] path Path to the backing file.
+ * @param[in] info Geometry of the chip, which flash_detect reports. NULL
+ *  selects the 2 MiB default used by flash_init.
+ * @param[in] timing Timings of the chip, or NULL for the typical numbers of a
+ *  W25Q-class part on a 12 MHz bus.
+ *
+ * @returns True on success, false if the file couldn't be opened or mapped.
+ */
+bool flash_emulator_open(
+	const char *path,
+	const struct flash_info *info,
+	const struct flash_emulator_timing *timing
+);
+
+/** Unmaps and closes the emulated flash chip, and releases its counters. */
+void flash_emulator_close(void);
+
+/** Gets the counters collected since the chip was opened or last reset.
+ *
+ * @returns A pointer to the counters.
+ */
+const struct flash_emulator_stats *flash_emulator_stats(void);
+
+/** Gets the number of times each erase block (erase[0] sized) was erased.
+ *
+ * @param[out] count Number of entries in the returned array.
+ *
+ * @returns A pointer to the per-block erase counters.
+ */
+const uint32_t *flash_emulator_wear(uint32_t *count);
+
+/** Resets the counters and the per-block erase counters. The simulated clock
+ * keeps running. */
+void flash_emulator_reset_stats(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // FLASH_EMULATOR_H_
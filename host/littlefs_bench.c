@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Replays the write patterns we use on the devices against the emulated flash
+// chip, and reports what they cost in flash operations and simulated time.
+
+#include "flash_emulator.h"
+
+#include <asimple_littlefs.h>
+#include <flash.h>
+
+#include <lfs.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct scenario
+{
+	const char *name;
+	int (*run)(
+		struct asimple_littlefs *fs,
+		uint32_t count,
+		uint32_t record_size,
+		uint64_t *bytes
+	);
+	uint32_t count;
+	uint32_t record_size;
+};
+
+// Sensor log: small fixed-size records appended to one file, synced every so
+// often so a reset loses little data
+static int append_log(
+	struct asimple_littlefs *fs,
+	uint32_t count,
+	uint32_t record_size,
+	uint64_t *bytes
+)
+{
+	lfs_file_t file;
+	int err = lfs_file_open(
+		&fs->lfs, &file, "log", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND
+	);
+	if (err < 0)
+		return err;
+
+	uint8_t record[256];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		memset(record, i & 0xFF, record_size);
+		lfs_ssize_t written =
+			lfs_file_write(&fs->lfs, &file, record, record_size);
+		if (written < 0)
+			return written;
+		*bytes += written;
+		if ((i % 16) == 15)
+		{
+			err = lfs_file_sync(&fs->lfs, &file);
+			if (err < 0)
+				return err;
+		}
+	}
+	return lfs_file_close(&fs->lfs, &file);
+}
+
+// Configuration: a small file rewritten in full every time a setting changes
+static int config_rewrite(
+	struct asimple_littlefs *fs,
+	uint32_t count,
+	uint32_t record_size,
+	uint64_t *bytes
+)
+{
+	uint8_t config[256];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		lfs_file_t file;
+		int err = lfs_file_open(
+			&fs->lfs, &file, "config", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC
+		);
+		if (err < 0)
+			return err;
+		memset(config, i & 0xFF, record_size);
+		lfs_ssize_t written =
+			lfs_file_write(&fs->lfs, &file, config, record_size);
+		if (written < 0)
+			return written;
+		*bytes += written;
+		err = lfs_file_close(&fs->lfs, &file);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+static void report(const char *name, uint32_t ops, uint64_t bytes)
+{
+	const struct flash_emulator_stats *stats = flash_emulator_stats();
+	uint32_t blocks;
+	const uint32_t *wear = flash_emulator_wear(&blocks);
+	uint32_t max_wear = 0;
+	uint32_t worn = 0;
+	for (uint32_t i = 0; i < blocks; ++i)
+	{
+		if (wear[i] > max_wear)
+			max_wear = wear[i];
+		if (wear[i])
+			worn += 1;
+	}
+
+	double seconds = stats->time_us / 1e6;
+	printf("%s:\n", name);
+	printf("  ops:                 %" PRIu32 "\n", ops);
+	printf("  simulated time:      %.3f s\n", seconds);
+	printf("  ops/s:               %.1f\n", seconds > 0 ? ops / seconds : 0.0);
+	printf("  bytes written:       %" PRIu64 "\n", bytes);
+	printf("  bytes programmed:    %" PRIu64 "\n", stats->program_bytes);
+	printf(
+		"  write amplification: %.2f\n",
+		bytes ? (double)stats->program_bytes / bytes : 0.0
+	);
+	printf("  programs:            %" PRIu64 "\n", stats->programs);
+	printf("  erases:              %" PRIu64 "\n", stats->erases);
+	printf(
+		"  blocks erased:       %" PRIu32 " of %" PRIu32 ", max %" PRIu32
+		" times\n",
+		worn, blocks, max_wear
+	);
+	printf(
+		"  reads:               %" PRIu64 " (%" PRIu64 " bytes)\n",
+		stats->reads, stats->read_bytes
+	);
+	printf("  status reads:        %" PRIu64 "\n", stats->status_reads);
+	printf("  transactions:        %" PRIu64 "\n", stats->transactions);
+	if (stats->rejected)
+		printf("  REJECTED COMMANDS:   %" PRIu64 "\n", stats->rejected);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "flash.img";
+	uint32_t scale = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+
+	if (!flash_emulator_open(path, NULL, NULL))
+	{
+		fprintf(stderr, "unable to open flash image %s\n", path);
+		return 1;
+	}
+
+	struct flash flash;
+	flash_init(&flash, NULL);
+	flash_detect(&flash);
+
+	const struct scenario scenarios[] = {
+		{"append log, 16 byte records", append_log, 4096 * scale, 16},
+		{"append log, 32 byte records", append_log, 4096 * scale, 32},
+		{"append log, 64 byte records", append_log, 2048 * scale, 64},
+		{"config rewrite, 64 bytes", config_rewrite, 256 * scale, 64},
+	};
+
+	struct asimple_littlefs fs;
+	if (!asimple_littlefs_init(&fs, &flash, NULL))
+	{
+		fprintf(stderr, "unable to configure littlefs\n");
+		flash_emulator_close();
+		return 1;
+	}
+
+	int result = 0;
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(*scenarios); ++i)
+	{
+		// Every scenario starts from a freshly formatted chip
+		int err = asimple_littlefs_format(&fs);
+		if (err == 0)
+			err = asimple_littlefs_mount(&fs);
+		if (err < 0)
+		{
+			fprintf(stderr, "unable to format/mount: %d\n", err);
+			result = 1;
+			break;
+		}
+
+		flash_emulator_reset_stats();
+		uint64_t bytes = 0;
+		err = scenarios[i].run(
+			&fs, scenarios[i].count, scenarios[i].record_size, &bytes
+		);
+		flash_wait_busy(&flash);
+		if (err < 0)
+		{
+			fprintf(stderr, "%s failed: %d\n", scenarios[i].name, err);
+			result = 1;
+		}
+		report(scenarios[i].name, scenarios[i].count, bytes);
+		asimple_littlefs_unmount(&fs);
+	}
+
+	flash_emulator_close();
+	return result;
+}
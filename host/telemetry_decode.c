@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Decodes the framed stream sent by the telemetry module (see telemetry.h)
+// and writes the payloads of every channel to their own file. The input is a
+// file or a serial port already configured for the right baud rate, e.g. with
+// stty.
+
+#include <crc32.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Anything longer than this between zero bytes is garbage
+#define MAX_FRAME_SIZE (1024 * 1024)
+
+struct channel
+{
+	FILE *file;
+	uint64_t frames;
+	uint64_t bytes;
+};
+
+struct decoder
+{
+	const char *prefix;
+	struct channel channels[256];
+	uint64_t crc_errors;
+	uint64_t format_errors;
+	uint64_t overruns;
+};
+
+// Decodes a COBS frame in place, returning the decoded size or -1 if the
+// frame is malformed
+static long cobs_decode(uint8_t *frame, size_t size)
+{
+	size_t read = 0;
+	size_t written = 0;
+	while (read < size)
+	{
+		uint8_t code = frame[read++];
+		if (code == 0 || read + code - 1 > size)
+			return -1;
+		for (uint8_t i = 1; i < code; ++i)
+			frame[written++] = frame[read++];
+		// The code stands in for a zero, except at the end of the frame and
+		// after a full block
+		if (code != 0xFF && read < size)
+			frame[written++] = 0;
+	}
+	return written;
+}
+
+// Writes out the payload of a frame. Errors are only counted if
+// count_errors is set
+static void dispatch(
+	struct decoder *decoder, uint8_t *frame, size_t size, bool count_errors
+)
+{
+	long decoded = cobs_decode(frame, size);
+	// Channel and CRC at least
+	if (decoded < 5)
+	{
+		if (count_errors)
+			decoder->format_errors += 1;
+		return;
+	}
+
+	size_t length = decoded - 4;
+	const uint8_t *trailer = frame + length;
+	uint32_t crc = trailer[0] | (uint32_t)trailer[1] << 8 |
+		(uint32_t)trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+	if (crc32(frame, length) != crc)
+	{
+		if (count_errors)
+			decoder->crc_errors += 1;
+		return;
+	}
+
+	struct channel *channel = &decoder->channels[frame[0]];
+	if (!channel->file)
+	{
+		char path[4096];
+		snprintf(path, sizeof(path), "%s%u.bin", decoder->prefix, frame[0]);
+		channel->file = fopen(path, "wb");
+		if (!channel->file)
+		{
+			fprintf(stderr, "unable to open %s\n", path);
+			exit(1);
+		}
+	}
+	fwrite(frame + 1, 1, length - 1, channel->file);
+	channel->frames += 1;
+	channel->bytes += length - 1;
+}
+
+static void report(const struct decoder *decoder)
+{
+	for (size_t i = 0; i < 256; ++i)
+	{
+		const struct channel *channel = &decoder->channels[i];
+		if (!channel->frames)
+			continue;
+		fprintf(
+			stderr,
+			"channel %zu: %" PRIu64 " frames, %" PRIu64 " bytes\n",
+			i,
+			channel->frames,
+			channel->bytes
+		);
+	}
+	fprintf(stderr, "CRC errors:    %" PRIu64 "\n", decoder->crc_errors);
+	fprintf(stderr, "format errors: %" PRIu64 "\n", decoder->format_errors);
+	fprintf(stderr, "overruns:      %" PRIu64 "\n", decoder->overruns);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3 || (argc > 1 && !strcmp(argv[1], "-h")))
+	{
+		fprintf(stderr, "usage: %s [input] [output prefix]\n", argv[0]);
+		fprintf(
+			stderr,
+			"Reads telemetry frames from input (default stdin), and writes "
+			"the\npayloads of every channel to <prefix><channel>.bin (default "
+			"prefix\n\"channel\").\n"
+		);
+		return 1;
+	}
+
+	FILE *input = stdin;
+	if (argc > 1 && strcmp(argv[1], "-"))
+	{
+		input = fopen(argv[1], "rb");
+		if (!input)
+		{
+			fprintf(stderr, "unable to open %s\n", argv[1]);
+			return 1;
+		}
+	}
+
+	static struct decoder decoder;
+	decoder.prefix = argc > 2 ? argv[2] : "channel";
+
+	uint8_t *frame = malloc(MAX_FRAME_SIZE);
+	if (!frame)
+		return 1;
+	size_t size = 0;
+	// Frames are only followed by a zero, so whatever comes before the first
+	// zero is either a whole frame, or the tail of one if the capture started
+	// mid-stream. Decode it anyway, COBS and the CRC reject a partial frame,
+	// but don't count that as an error
+	bool synced = false;
+	bool overrun = false;
+	int c;
+	while ((c = fgetc(input)) != EOF)
+	{
+		if (c)
+		{
+			if (size < MAX_FRAME_SIZE)
+				frame[size++] = c;
+			else
+				overrun = true;
+			continue;
+		}
+
+		if (overrun)
+			decoder.overruns += 1;
+		else if (size)
+			dispatch(&decoder, frame, size, synced);
+		synced = true;
+		overrun = false;
+		size = 0;
+	}
+
+	for (size_t i = 0; i < 256; ++i)
+	{
+		if (decoder.channels[i].file)
+			fclose(decoder.channels[i].file);
+	}
+	if (input != stdin)
+		fclose(input);
+	free(frame);
+	report(&decoder);
+	return 0;
+}
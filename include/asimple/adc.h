@@ -7,6 +7,8 @@
 
 #include "am_hal_adc.h"
 
+#include <adc_convert.h>
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -16,9 +18,62 @@ extern "C"
 {
 #endif
 
+/** Highest scan rate accepted by adc_set_sample_rate, in Hz. */
+#define ADC_MAX_SAMPLE_RATE 1200000
+
+/** Number of ADC slots, the most channels sampled in one scan. */
+#define ADC_MAX_SLOTS 8
+
+/** Marks slots whose samples aren't wanted in an adc_request. */
+#define ADC_NO_OUTPUT 0xFF
+
 /** ADC structure forward declaration. */
 struct adc;
 
+/** A read of a set of channels, prepared by adc_prepare_request so repeated
+ * reads don't have to look up channels again. */
+struct adc_request
+{
+	/** Index in the output of the sample of every slot, or ADC_NO_OUTPUT. */
+	uint8_t outputs[ADC_MAX_SLOTS];
+};
+
+/** Trade-offs between the latency of a scan and the power used between
+ * scans. */
+enum adc_power_mode
+{
+	/** Clock and ADC stay on between scans, scans start right away. */
+	ADC_POWER_LOW_LATENCY,
+	/** The ADC clock is gated off between scans. */
+	ADC_POWER_GATED_CLOCK,
+	/** The ADC powers down between scans, and needs time to start up before
+	 * every scan. Best for slow timed sampling. */
+	ADC_POWER_DOWN_BETWEEN_SCANS,
+};
+
+/** Conversion settings of a slot. */
+struct adc_slot_config
+{
+	/** Resolution in bits: 8, 10, 12, or 14. Samples range from 0 to
+	 * 2^precision - 1. */
+	uint8_t precision;
+	/** Number of conversions averaged in hardware into every sample: a power
+	 * of two from 1 to 128. Every sample takes that many conversions. */
+	uint8_t averages;
+	/** Whether samples from the slot are checked against the window set by
+	 * adc_set_window. */
+	bool window_compare;
+};
+
+/** Largest window limit, the largest 14 bit sample. */
+#define ADC_WINDOW_MAX 0x3FFF
+
+/** Function called by the ADC interrupt when samples cross the window.
+ *
+ * @param[in,out] context Context given to adc_set_window_callbacks.
+ */
+typedef void (*adc_window_callback)(void *context);
+
 /** Returns the ADC instance.
  *
  * If it hasn't been initialized, it initializes the ADC instance. Before use
@@ -36,8 +91,21 @@ struct adc;
  * @param[in] size Size of pin array.
  */
 struct adc *adc_get_instance(const uint8_t pins[], uint8_t size);
-// struct adc *adc_get_instance_channels(struct adc *adc, const
-// am_hal_adc_slot_chan_e channels[], size_t size);
+
+/** Returns the ADC instance, like adc_get_instance, but configures slots by
+ * ADC channel instead of by pin.
+ *
+ * This is the only way to sample the differential channels
+ * (AM_HAL_ADC_SLOT_CHSEL_DF0 and AM_HAL_ADC_SLOT_CHSEL_DF1, each using a pair
+ * of pins) and the internal ones (temperature, battery, VSS). Differential
+ * and single-ended channels can be mixed in one scan.
+ *
+ * @param[in] channels Array of channels to configure, one per slot.
+ * @param[in] size Size of channel array, at most 8.
+ */
+struct adc *adc_get_instance_channels(
+	const am_hal_adc_slot_chan_e channels[], uint8_t size
+);
 
 /** Deinitializes the given adc structure, freeing resources held, including
  * the associated UART instance, once all borrowed instances are
@@ -68,6 +136,7 @@ bool adc_sleep(struct adc *adc);
  *
  * The sample and pins arrays must be the same size.
  * Samples will be placed at locations corresponding to pins[]
+ * Samples from differential channels are signed, cast them to int32_t.
  *
  * @param[in] adc Pointer to the ADC object to use.
  * @param[out] out_samples Data extracted from the ADC, if there is data
@@ -87,12 +156,259 @@ bool adc_get_sample_channels(
 	const am_hal_adc_slot_chan_e channels[], size_t size
 );
 
+/** Prepares a read of the given channels, for adc_get_sample_request.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[out] request Prepared read.
+ * @param[in] channels The channels we want to get data from, in the order
+ *  their samples are placed in the output. Channels not configured in any
+ *  slot are skipped.
+ * @param[in] size The number of channels, at most ADC_MAX_SLOTS.
+ *
+ * @returns True on success, false if there are too many or invalid channels.
+ */
+bool adc_prepare_request(
+	const struct adc *adc,
+	struct adc_request *request,
+	const am_hal_adc_slot_chan_e channels[],
+	size_t size
+);
+
+/** Prepares a read of the given pins, for adc_get_sample_request.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[out] request Prepared read.
+ * @param[in] pins The pins we want to get data from, in the order their
+ *  samples are placed in the output.
+ * @param[in] size The number of pins, at most ADC_MAX_SLOTS.
+ *
+ * @returns True on success, false if there are too many pins.
+ */
+bool adc_prepare_request_pins(
+	const struct adc *adc,
+	struct adc_request *request,
+	const uint8_t pins[],
+	size_t size
+);
+
+/** Get a batch of samples from the ADC, as prepared by adc_prepare_request.
+ *
+ * This reads a whole scan from the FIFO, and places every sample at its
+ * prepared index, with no lookups. Samples from differential channels are
+ * sign extended, cast them to int32_t.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[out] out_samples Data extracted from the ADC, if there is data
+ *  available.
+ * @param[in] request Prepared read.
+ *
+ * @returns True if there was data in the queue to extract, false otherwise.
+ */
+bool adc_get_sample_request(
+	struct adc *adc, uint32_t out_samples[], const struct adc_request *request
+);
+
+/** Sets the resolution, averaging, and window comparison of a slot.
+ *
+ * Slots are numbered in the order their pins were given to adc_get_instance,
+ * and start at 14 bits without averaging, checked against the window. Lower
+ * resolutions convert faster, and averaging reduces noise at the cost of
+ * conversion time, without using the processor.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[in] slot Slot to configure.
+ * @param[in] config New settings of the slot.
+ *
+ * @returns True on success, false if the slot or settings are invalid, or the
+ *  ADC could not be reconfigured, in which case the old settings are kept.
+ */
+bool adc_set_slot_config(
+	struct adc *adc, uint8_t slot, const struct adc_slot_config *config
+);
+
+/** Gets the resolution and averaging of a slot.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[in] slot Slot to query.
+ * @param[out] config Settings of the slot.
+ *
+ * @returns True on success, false if the slot is not configured.
+ */
+bool adc_get_slot_config(
+	const struct adc *adc, uint8_t slot, struct adc_slot_config *config
+);
+
+/** Sets the limits of the window comparator.
+ *
+ * Samples from slots with window_compare set are compared in hardware
+ * against the window, see adc_set_window_callbacks.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[in] lower Lowest sample inside the window.
+ * @param[in] upper Highest sample inside the window, at most ADC_WINDOW_MAX.
+ *  Both limits are in 14 bit units, and are scaled down for slots with lower
+ *  precision.
+ *
+ * @returns True on success, false if the limits are invalid.
+ */
+bool adc_set_window(struct adc *adc, uint32_t lower, uint32_t upper);
+
+/** Sets the functions called when samples cross the window.
+ *
+ * The first callback reports which side of the window samples are on, after
+ * that they are called only when samples cross to the other side. While
+ * callbacks are set and the ADC isn't streaming, the per-sample interrupts
+ * are masked, so with adc_set_sample_rate the processor can stay asleep
+ * until a reading leaves (or comes back into) the window. Samples still
+ * accumulate in the FIFO for adc_get_sample.
+ *
+ * The callbacks run in interrupt context.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[in] inside Called when samples enter the window, may be NULL.
+ * @param[in] outside Called when samples leave the window, may be NULL.
+ * @param[in,out] context Passed to the callbacks.
+ */
+void adc_set_window_callbacks(
+	struct adc *adc,
+	adc_window_callback inside,
+	adc_window_callback outside,
+	void *context
+);
+
+/** Reads the calibration of the die temperature sensor, for
+ * adc_convert_temperature_curve.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[out] trims Calibration of the sensor, or
+ *  ADC_CONVERT_TEMPERATURE_TRIMS_DEFAULT if it was never calibrated.
+ *
+ * @returns True if the device was calibrated, false if the defaults are used.
+ */
+bool adc_get_temperature_trims(
+	struct adc *adc, struct adc_convert_temperature_trims *trims
+);
+
+/** Sets the ADC clock and power modes, ADC_POWER_LOW_LATENCY by default.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[in] mode New power mode.
+ *
+ * @returns True on success, false if the mode is invalid or the ADC could not
+ *  be reconfigured, in which case the old mode is kept.
+ */
+bool adc_set_power_mode(struct adc *adc, enum adc_power_mode mode);
+
 /** Trigger the ADC to collect a sample.
  *
  * This triggers the ADC to collect a single sample.
  */
 void adc_trigger(struct adc *adc);
 
+/** Samples at a fixed rate, with scans triggered by timer 3.
+ *
+ * Picks the timer 3 clock source (crystal, LFRC, or HFRC) and period that
+ * come closest to the requested rate, and switches the ADC to repeating scans
+ * triggered by the timer, so sampling doesn't depend on when adc_trigger is
+ * called. Every trigger scans all configured slots. Samples accumulate in the
+ * ADC FIFO for adc_get_sample, or are moved out by adc_stream_start.
+ *
+ * This can be called again to change the rate while sampling or streaming.
+ * Timer 3 is stopped while the ADC is asleep.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[in] hz Requested scan rate in Hz, or 0 to stop timed sampling (and
+ *  any stream) and return to software triggered single scans.
+ *
+ * @returns The rate actually achieved, in mHz, or 0 if the rate can't be
+ *  reached or 0 was requested.
+ */
+uint32_t adc_set_sample_rate(struct adc *adc, uint32_t hz);
+
+/** Gets the rate timed sampling runs at.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ *
+ * @returns The scan rate in mHz, 8000 until adc_set_sample_rate is called.
+ */
+uint32_t adc_get_sample_rate(const struct adc *adc);
+
+/** Function called by the ADC interrupt every time a stream buffer is full.
+ *
+ * Every entry of the buffer is a raw ADC FIFO word, use AM_HAL_ADC_FIFO_SLOT
+ * and AM_HAL_ADC_FIFO_SAMPLE to split it into the slot and the sample. This
+ * runs in interrupt context and the buffer is refilled once the other buffer
+ * is full, so it must either process the buffer quickly or hand it off to the
+ * main loop.
+ *
+ * @param[in,out] context Context given to adc_stream_start.
+ * @param[in] samples The buffer that was just filled.
+ * @param[in] count Number of samples in the buffer.
+ */
+typedef void (*adc_stream_callback)(
+	void *context, const uint32_t *samples, size_t count
+);
+
+/** Statistics kept while streaming. */
+struct adc_stream_stats
+{
+	/** Number of buffers handed to the callback. */
+	uint32_t buffers;
+	/** Number of DMA errors, the buffer being filled is dropped. */
+	uint32_t dma_errors;
+	/** Number of times the ADC FIFO overflowed and samples were lost. */
+	uint32_t fifo_overflows;
+};
+
+/** Starts sampling continuously into a pair of buffers using DMA.
+ *
+ * The ADC is switched to repeating scans, triggered by timer 3 at the rate
+ * given by adc_get_sample_rate, and every scan result is moved by DMA into
+ * one of the buffers, without waking up the processor. When a buffer is full,
+ * DMA moves on to the other one and the callback is called with the full one.
+ *
+ * The ADC must be enabled. adc_trigger, adc_get_sample, and
+ * adc_get_sample_channels must not be used while streaming.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ * @param[out] buffer0 First buffer, filled first.
+ * @param[out] buffer1 Second buffer.
+ * @param[in] count Number of samples in each buffer. Should be a multiple of
+ *  the number of slots configured so scans aren't split across buffers.
+ * @param[in] callback Function called with every full buffer.
+ * @param[in,out] context Passed to callback.
+ *
+ * @returns True on success, false if the arguments are invalid, the ADC is
+ *  already streaming, or DMA could not be configured.
+ */
+bool adc_stream_start(
+	struct adc *adc,
+	uint32_t *buffer0,
+	uint32_t *buffer1,
+	size_t count,
+	adc_stream_callback callback,
+	void *context
+);
+
+/** Stops streaming.
+ *
+ * Samples in the buffer being filled are discarded. If timed sampling was
+ * started with adc_set_sample_rate it keeps going, otherwise the ADC returns
+ * to software triggered single scans.
+ *
+ * @param[in,out] adc Pointer to the ADC object to use.
+ */
+void adc_stream_stop(struct adc *adc);
+
+/** Gets the statistics of the current or last stream.
+ *
+ * @param[in] adc Pointer to the ADC object to use.
+ * @param[out] stats Statistics, reset by adc_stream_start.
+ */
+void adc_stream_get_stats(
+	const struct adc *adc, struct adc_stream_stats *stats
+);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
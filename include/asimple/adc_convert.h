@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef ADC_CONVERT_H_
+#define ADC_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Reference voltage the ADC is configured with, in mV. */
+#define ADC_CONVERT_REFERENCE_MV 2000
+
+/** Largest reference voltage the conversions support, in mV. */
+#define ADC_CONVERT_MAX_REFERENCE_MV 16000
+
+/** Ratio between a voltage and what reaches the ADC through a divider. */
+struct adc_convert_divider
+{
+	uint32_t numerator;
+	uint32_t denominator;
+};
+
+/** Divider in front of the AM_HAL_ADC_SLOT_CHSEL_BATT channel, which
+ * measures VDD divided by 3. */
+#define ADC_CONVERT_BATTERY_DIVIDER                                            \
+	((struct adc_convert_divider){.numerator = 3, .denominator = 1})
+
+/** Calibration of the die temperature sensor, read from the device with
+ * adc_get_temperature_trims.
+ *
+ * The sensor voltage is proportional to the absolute temperature, once the
+ * offset is removed.
+ */
+struct adc_convert_temperature_trims
+{
+	/** Temperature the sensor was calibrated at, in K. */
+	float calibration_kelvin;
+	/** Sensor voltage at the calibration temperature, in V. */
+	float calibration_volts;
+	/** ADC offset, in V. */
+	float offset_volts;
+};
+
+/** Calibration used by the HAL for devices that were never calibrated. */
+#define ADC_CONVERT_TEMPERATURE_TRIMS_DEFAULT                                  \
+	((struct adc_convert_temperature_trims){                                   \
+		.calibration_kelvin = 300.0f,                                          \
+		.calibration_volts = 1.02809f,                                         \
+		.offset_volts = -0.004281f,                                            \
+	})
+
+/** Die temperature sensor curve, precomputed for one precision and reference
+ * by adc_convert_temperature_curve. */
+struct adc_convert_temperature_curve
+{
+	/** Degrees Celsius per count. */
+	float slope;
+	/** Degrees Celsius at 0 counts. */
+	float intercept;
+};
+
+/** Converts a sample to millivolts, rounded to the nearest millivolt.
+ *
+ * @param[in] sample Sample as returned by adc_get_sample.
+ * @param[in] precision Precision of the slot the sample came from, in bits.
+ * @param[in] reference_mv Reference voltage, at most
+ *  ADC_CONVERT_MAX_REFERENCE_MV.
+ *
+ * @returns The voltage at the ADC input in mV.
+ */
+uint32_t adc_convert_millivolts(
+	uint32_t sample, uint8_t precision, uint32_t reference_mv
+);
+
+/** Converts a buffer of raw ADC FIFO words, such as the ones filled by
+ * adc_stream_start, to millivolts.
+ *
+ * The fractional bits the FIFO keeps from hardware averaging are used, and
+ * the results are rounded to the nearest millivolt. All words must come from
+ * slots with the same precision.
+ *
+ * @param[in] words Raw FIFO words.
+ * @param[out] millivolts The voltage of every word in mV. May be the same
+ *  buffer as words.
+ * @param[in] count Number of words.
+ * @param[in] precision Precision of the slots the words came from, in bits.
+ * @param[in] reference_mv Reference voltage, at most
+ *  ADC_CONVERT_MAX_REFERENCE_MV.
+ */
+void adc_convert_millivolts_bulk(
+	const uint32_t *words,
+	uint32_t *millivolts,
+	size_t count,
+	uint8_t precision,
+	uint32_t reference_mv
+);
+
+/** Decodes a sample from a differential slot, which is in two's complement.
+ *
+ * adc_get_sample already does this for differential slots, this is meant for
+ * samples taken out of raw FIFO words with AM_HAL_ADC_FIFO_SAMPLE.
+ *
+ * @param[in] sample Sample from a differential slot.
+ * @param[in] precision Precision of the slot the sample came from, in bits.
+ *
+ * @returns The signed sample.
+ */
+int32_t adc_convert_signed(uint32_t sample, uint8_t precision);
+
+/** Converts a signed sample from a differential slot to millivolts, rounded
+ * to the nearest millivolt.
+ *
+ * @param[in] sample Signed sample, as returned by adc_get_sample (cast to
+ *  int32_t) or adc_convert_signed.
+ * @param[in] precision Precision of the slot the sample came from, in bits.
+ * @param[in] reference_mv Reference voltage, at most
+ *  ADC_CONVERT_MAX_REFERENCE_MV.
+ *
+ * @returns The voltage between the positive and negative inputs in mV.
+ */
+int32_t adc_convert_differential_millivolts(
+	int32_t sample, uint8_t precision, uint32_t reference_mv
+);
+
+/** Recovers the voltage in front of a divider.
+ *
+ * @param[in] millivolts Voltage measured by the ADC in mV.
+ * @param[in] divider Divider between the voltage and the ADC.
+ *
+ * @returns The voltage before the divider in mV, rounded to the nearest mV.
+ */
+uint32_t adc_convert_divider(
+	uint32_t millivolts, const struct adc_convert_divider *divider
+);
+
+/** Converts a sample of the AM_HAL_ADC_SLOT_CHSEL_BATT channel to the supply
+ * voltage.
+ *
+ * @param[in] sample Sample as returned by adc_get_sample.
+ * @param[in] precision Precision of the slot the sample came from, in bits.
+ * @param[in] reference_mv Reference voltage, at most
+ *  ADC_CONVERT_MAX_REFERENCE_MV.
+ *
+ * @returns The supply voltage in mV.
+ */
+uint32_t adc_convert_battery_millivolts(
+	uint32_t sample, uint8_t precision, uint32_t reference_mv
+);
+
+/** Precomputes the die temperature sensor curve, so every conversion is a
+ * single multiply-add in single precision.
+ *
+ * @param[out] curve Curve to compute.
+ * @param[in] trims Calibration of the sensor.
+ * @param[in] precision Precision of the slot sampling
+ *  AM_HAL_ADC_SLOT_CHSEL_TEMP, in bits.
+ * @param[in] reference_mv Reference voltage in mV.
+ */
+void adc_convert_temperature_curve(
+	struct adc_convert_temperature_curve *curve,
+	const struct adc_convert_temperature_trims *trims,
+	uint8_t precision,
+	uint32_t reference_mv
+);
+
+/** Converts a sample of the AM_HAL_ADC_SLOT_CHSEL_TEMP channel to the die
+ * temperature.
+ *
+ * @param[in] curve Curve computed by adc_convert_temperature_curve.
+ * @param[in] sample Sample as returned by adc_get_sample.
+ *
+ * @returns The die temperature in degrees Celsius.
+ */
+float adc_convert_celsius(
+	const struct adc_convert_temperature_curve *curve, uint32_t sample
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // ADC_CONVERT_H_
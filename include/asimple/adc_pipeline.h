@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef ADC_PIPELINE_H_
+#define ADC_PIPELINE_H_
+
+#include <arm_math.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef ADC_PIPELINE_MAX_CHANNELS
+/** Largest number of channels (slots per scan) a pipeline handles. */
+#define ADC_PIPELINE_MAX_CHANNELS 8
+#endif
+
+#ifndef ADC_PIPELINE_MAX_BLOCK
+/** Largest number of scans in a block. */
+#define ADC_PIPELINE_MAX_BLOCK 256
+#endif
+
+#ifndef ADC_PIPELINE_MAX_TAPS
+/** Largest number of FIR filter taps. */
+#define ADC_PIPELINE_MAX_TAPS 64
+#endif
+
+/** Largest number of CIC integrator and comb stages. */
+#define ADC_PIPELINE_MAX_CIC_STAGES 4
+
+/** Settings of a decimation pipeline. */
+struct adc_pipeline_config
+{
+	/** Number of slots in every scan, each becomes a channel. */
+	uint8_t channels;
+	/** Precision of the slots, in bits. All slots must use the same one. */
+	uint8_t precision;
+	/** Whether the slots are differential, so samples are signed. */
+	bool differential;
+	/** Number of scans in every block, a multiple of the total decimation,
+	 * at most ADC_PIPELINE_MAX_BLOCK. Blocks are usually one stream buffer,
+	 * see adc_stream_start. */
+	uint16_t block_size;
+	/** DC removal time constant, as a power of two of blocks: the DC estimate
+	 * moves 1/2^dc_shift of the way to the mean of every block. 0 disables
+	 * DC removal. */
+	uint8_t dc_shift;
+	/** Number of CIC stages, at most ADC_PIPELINE_MAX_CIC_STAGES. 0 skips the
+	 * CIC decimator. */
+	uint8_t cic_stages;
+	/** CIC decimation factor, a power of two. The CIC gain,
+	 * cic_decimation^cic_stages, must be at most 2^16. */
+	uint16_t cic_decimation;
+	/** Number of FIR taps, at most ADC_PIPELINE_MAX_TAPS. 0 skips the FIR
+	 * decimator. */
+	uint16_t fir_taps;
+	/** FIR decimation factor. */
+	uint8_t fir_decimation;
+	/** FIR coefficients in q15, in time reversed order as expected by
+	 * CMSIS-DSP. Must outlive the pipeline. */
+	const q15_t *fir_coefficients;
+};
+
+/** Statistics of a pipeline. */
+struct adc_pipeline_stats
+{
+	/** Number of blocks processed. */
+	uint32_t blocks;
+	/** Number of samples found in a different slot than expected, e.g.
+	 * after a FIFO overflow. */
+	uint32_t slot_errors;
+};
+
+/** State of a single channel, internal to the pipeline. */
+struct adc_pipeline_channel
+{
+	arm_fir_decimate_instance_q15 fir;
+	q15_t fir_state[ADC_PIPELINE_MAX_TAPS + ADC_PIPELINE_MAX_BLOCK - 1];
+	uint32_t integrators[ADC_PIPELINE_MAX_CIC_STAGES];
+	uint32_t combs[ADC_PIPELINE_MAX_CIC_STAGES];
+	// DC estimate, q15 with 16 more fractional bits
+	int32_t dc;
+};
+
+/** Decimation and filtering pipeline for multi-channel ADC scans.
+ *
+ * Every block goes through, per channel: conversion to q15, DC removal, a CIC
+ * decimator, and a FIR decimator. The result is a frame per output sample
+ * period, with a q15 sample per channel, ready to be logged.
+ *
+ * The members are internal, use the functions below.
+ */
+struct adc_pipeline
+{
+	struct adc_pipeline_config config;
+	struct adc_pipeline_stats stats;
+	struct adc_pipeline_channel channels[ADC_PIPELINE_MAX_CHANNELS];
+	q15_t input[ADC_PIPELINE_MAX_BLOCK];
+	q15_t output[ADC_PIPELINE_MAX_BLOCK];
+};
+
+/** Initializes a pipeline.
+ *
+ * @param[out] pipeline Pipeline to initialize.
+ * @param[in] config Settings of the pipeline.
+ *
+ * @returns True on success, false if the settings are invalid or don't fit
+ *  the ADC_PIPELINE_MAX_ limits.
+ */
+bool adc_pipeline_init(
+	struct adc_pipeline *pipeline, const struct adc_pipeline_config *config
+);
+
+/** Gets the number of frames a block turns into.
+ *
+ * @param[in] pipeline Pipeline to query.
+ *
+ * @returns Frames per block, each with a sample per channel.
+ */
+size_t adc_pipeline_block_frames(const struct adc_pipeline *pipeline);
+
+/** Runs raw FIFO words through the pipeline, e.g. from an
+ * adc_stream_callback.
+ *
+ * @param[in,out] pipeline Pipeline to use.
+ * @param[in] words Raw FIFO words, whole blocks of block_size scans.
+ * @param[in] count Number of words, a multiple of block_size * channels.
+ * @param[out] frames Decimated frames, interleaved: the samples of every
+ *  channel for the first output period, then for the second, and so on. Must
+ *  hold adc_pipeline_block_frames * channels samples per block.
+ *
+ * @returns The number of frames written.
+ */
+size_t adc_pipeline_process(
+	struct adc_pipeline *pipeline,
+	const uint32_t *words,
+	size_t count,
+	q15_t *frames
+);
+
+/** Gets the statistics of a pipeline.
+ *
+ * @param[in] pipeline Pipeline to query.
+ * @param[out] stats Statistics since adc_pipeline_init.
+ */
+void adc_pipeline_get_stats(
+	const struct adc_pipeline *pipeline, struct adc_pipeline_stats *stats
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // ADC_PIPELINE_H_
@@ -8,19 +8,85 @@
 #include <flash.h>
 #include <lfs.h>
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+#ifndef ASIMPLE_LITTLEFS_MAX_CACHE_SIZE
+/** Size of the built-in read and program caches, and of each per-file cache
+ * used by the littlefs syscalls. Must be at least the flash page size. */
+#define ASIMPLE_LITTLEFS_MAX_CACHE_SIZE 256
+#endif
+
+#ifndef ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE
+/** Size of the built-in lookahead buffer. Every byte tracks 8 blocks, so the
+ * default covers a 16 MiB chip with 4 KiB blocks. */
+#define ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE 512
+#endif
+
+/** Tunables for the littlefs glue.
+ *
+ * Zero fields are replaced by defaults derived from the flash geometry. NULL
+ * buffers are replaced by the buffers built into struct asimple_littlefs,
+ * which limits the lookahead size to ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE.
+ * The cache size is always limited to ASIMPLE_LITTLEFS_MAX_CACHE_SIZE, as
+ * that is the size of the per-file caches used by the littlefs syscalls.
+ */
+struct asimple_littlefs_config
+{
+	/** Size of the read and program caches, defaults to the page size. At most
+	 * ASIMPLE_LITTLEFS_MAX_CACHE_SIZE, even with caller buffers. */
+	uint32_t cache_size;
+	/** Size of the lookahead bitmap in bytes, a multiple of 8. Defaults to
+	 * enough to track every block on the chip. */
+	uint32_t lookahead_size;
+	/** Erase cycles before littlefs moves metadata, defaults to 250. */
+	int32_t block_cycles;
+	/** Read cache of cache_size bytes, or NULL. */
+	void *read_buffer;
+	/** Program cache of cache_size bytes, or NULL. */
+	void *prog_buffer;
+	/** Lookahead buffer of lookahead_size bytes, 4-byte aligned, or NULL. */
+	void *lookahead_buffer;
+};
+
 struct asimple_littlefs
 {
 	struct flash *flash;
+	/** Whether a program or erase may still be in progress on the chip. */
+	bool busy;
 	lfs_t lfs;
 	struct lfs_config config;
+	uint8_t read_buffer[ASIMPLE_LITTLEFS_MAX_CACHE_SIZE];
+	uint8_t prog_buffer[ASIMPLE_LITTLEFS_MAX_CACHE_SIZE];
+	uint32_t lookahead_buffer[ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE / 4];
 };
 
-void asimple_littlefs_init(struct asimple_littlefs *fs, struct flash *flash);
+/** Initializes the littlefs glue for the given flash chip.
+ *
+ * The filesystem geometry is taken from flash->info, so call flash_detect
+ * beforehand to use the whole chip with its native erase and page sizes.
+ *
+ * littlefs is always given buffers, either from the config or from fs
+ * itself, so it never allocates memory for the filesystem.
+ *
+ * @param[out] fs Littlefs object to initialize.
+ * @param[in,out] flash Flash chip to hold the filesystem.
+ * @param[in] config Tunables to use, or NULL for the defaults. It is not
+ *  referenced after this returns, but its buffers are.
+ *
+ * @returns True on success, false if the requested sizes don't fit the
+ *  built-in buffers or don't suit the flash geometry.
+ */
+bool asimple_littlefs_init(
+	struct asimple_littlefs *fs,
+	struct flash *flash,
+	const struct asimple_littlefs_config *config
+);
 int asimple_littlefs_format(struct asimple_littlefs *fs);
 int asimple_littlefs_mount(struct asimple_littlefs *fs);
 int asimple_littlefs_unmount(struct asimple_littlefs *fs);
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef BINLOG_H_
+#define BINLOG_H_
+
+#include <telemetry.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef BINLOG_BUFFER_WORDS
+/** Size of the RAM ring holding records until they are drained, in 32 bit
+ * words. Must be a power of two. */
+#define BINLOG_BUFFER_WORDS 1024
+#endif
+
+#ifndef BINLOG_TELEMETRY_CHANNEL
+/** Telemetry channel used by binlog_sink_telemetry. */
+#define BINLOG_TELEMETRY_CHANNEL 0xB1
+#endif
+
+/** Largest number of arguments a record can hold. */
+#define BINLOG_MAX_ARGS 7
+
+/** Largest size of a record, in 32 bit words. */
+#define BINLOG_MAX_RECORD_WORDS (2 + BINLOG_MAX_ARGS)
+
+/** Logs a record, to be formatted on the host.
+ *
+ * Instead of formatting the message, this only stores the address of the
+ * format string, a timestamp, and the arguments as raw 32 bit words into a RAM
+ * ring, which takes a few dozen cycles. The format strings are placed in the
+ * .binlog section, which is not loaded onto the device, and host/binlog.py
+ * recovers them from the ELF to format the records.
+ *
+ * Arguments are converted to uint32_t, so only integer conversions (d, i, u,
+ * x, X, o, c) are supported. Pointers must be cast to uintptr_t, and
+ * floating point values scaled to integers.
+ *
+ * This is safe to call from interrupts. If the ring is full, the record is
+ * dropped and counted, see binlog_dropped.
+ *
+ * @param[in] ... printf-style format string, which must be a string literal,
+ *  followed by up to BINLOG_MAX_ARGS integer arguments.
+ */
+#define BINLOG(...) BINLOG_(__VA_ARGS__, 0)
+
+// The extra zero argument keeps __VA_ARGS__ from being empty without
+// __VA_OPT__, the arguments are the ones before it
+#define BINLOG_(format, ...)                                                   \
+	do                                                                         \
+	{                                                                          \
+		static const char binlog_format_[]                                     \
+			__attribute__((section(".binlog"), used)) = format;                \
+		const uint32_t binlog_args_[] = {__VA_ARGS__};                         \
+		static_assert(                                                         \
+			sizeof(binlog_args_) / sizeof(uint32_t) <= BINLOG_MAX_ARGS + 1,    \
+			"too many arguments for BINLOG"                                    \
+		);                                                                     \
+		binlog_write(                                                          \
+			binlog_format_,                                                    \
+			binlog_args_,                                                      \
+			sizeof(binlog_args_) / sizeof(uint32_t) - 1                        \
+		);                                                                     \
+	} while (0)
+
+/** Function called by binlog_drain with every record.
+ *
+ * Records are a header word (bit 31 set, the number of arguments in bits 24
+ * to 26, and the offset of the format string in the .binlog section in bits 0
+ * to 23), the low 32 bits of systick_jiffies when the record was logged, and
+ * the arguments.
+ *
+ * @param[in,out] context Context given to binlog_drain.
+ * @param[in] record Record to store or send.
+ * @param[in] words Size of the record in 32 bit words.
+ *
+ * @returns True if the record was consumed, false to stop draining and leave
+ *  the record in the ring.
+ */
+typedef bool (*binlog_sink)(
+	void *context, const uint32_t *record, size_t words
+);
+
+/** Adds a record to the ring, use the BINLOG macro instead.
+ *
+ * @param[in] format Format string, in the .binlog section.
+ * @param[in] args Arguments of the record.
+ * @param[in] count Number of arguments, at most BINLOG_MAX_ARGS.
+ */
+void binlog_write(const char *format, const uint32_t *args, size_t count);
+
+/** Moves records out of the ring, oldest first.
+ *
+ * This is meant to be called from the main loop (e.g. before going to sleep),
+ * not from interrupts. Only one caller may drain at a time.
+ *
+ * @param[in] sink Function called with every record.
+ * @param[in,out] context Passed to sink.
+ *
+ * @returns The number of records drained.
+ */
+size_t binlog_drain(binlog_sink sink, void *context);
+
+/** Sink sending every record as a frame on a telemetry transport, on channel
+ * BINLOG_TELEMETRY_CHANNEL.
+ *
+ * @param[in,out] telemetry Telemetry transport to send records on.
+ * @param[in] record Record to send.
+ * @param[in] words Size of the record in 32 bit words.
+ *
+ * @returns True.
+ */
+bool binlog_sink_telemetry(
+	void *telemetry, const uint32_t *record, size_t words
+);
+
+/** Sink writing every record to a file descriptor, e.g. a file opened on a
+ * littlefs mount.
+ *
+ * @param[in] fd Pointer to an int holding the file descriptor.
+ * @param[in] record Record to write.
+ * @param[in] words Size of the record in 32 bit words.
+ *
+ * @returns True if the record was written, false otherwise.
+ */
+bool binlog_sink_fd(void *fd, const uint32_t *record, size_t words);
+
+/** Gets the number of records dropped because the ring was full.
+ *
+ * @returns The number of records dropped since boot.
+ */
+uint32_t binlog_dropped(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // BINLOG_H_
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Continues a CRC-32 (IEEE 802.3, as used by zlib and Ethernet) over more
+ * data.
+ *
+ * @param[in] crc CRC of the data so far, or 0 to start a new CRC.
+ * @param[in] data Data to add to the CRC.
+ * @param[in] size Number of bytes in data.
+ *
+ * @returns The CRC of all of the data so far.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+
+/** Computes the CRC-32 (IEEE 802.3) of the given data.
+ *
+ * @param[in] data Data to compute the CRC of.
+ * @param[in] size Number of bytes in data.
+ *
+ * @returns The CRC of the data.
+ */
+uint32_t crc32(const void *data, size_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // CRC32_H_
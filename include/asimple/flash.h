@@ -7,8 +7,10 @@
 #ifndef FLASH_H_
 #define FLASH_H_
 
+#include <mspi.h>
 #include <spi.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -16,13 +18,104 @@ extern "C"
 {
 #endif
 
+/** Describes one of the erase commands supported by the flash chip. */
+struct flash_erase_type
+{
+	/** Size of the erased region in bytes, 0 if this type is unused. */
+	uint32_t size;
+	/** Opcode of the erase command. */
+	uint8_t opcode;
+	/** Typical time the erase takes, in milliseconds, 0 if unknown. */
+	uint32_t typical_ms;
+};
+
+/** Describes one of the read commands supported by the flash chip. */
+struct flash_read_mode
+{
+	/** Opcode of the read command, 0 if the mode isn't supported. */
+	uint8_t opcode;
+	/** Number of dummy clocks between the address and the data. */
+	uint8_t dummy_clocks;
+	/** Number of mode clocks between the address and the dummy clocks. */
+	uint8_t mode_clocks;
+};
+
+/** How the quad enable bit is set, as described by JESD216A DWORD 15. */
+enum flash_quad_enable
+{
+	/** No quad enable bit, or the chip has no quad modes. */
+	FLASH_QUAD_ENABLE_NONE = 0,
+	/** Bit 1 of status register 2, written with a 2-byte 0x01 command which
+	 * can't be read back. */
+	FLASH_QUAD_ENABLE_SR2_BIT1_NO_READ = 1,
+	/** Bit 6 of status register 1, written with a 1-byte 0x01 command. */
+	FLASH_QUAD_ENABLE_SR1_BIT6 = 2,
+	/** Bit 7 of status register 2, read with 0x3F and written with 0x3E. */
+	FLASH_QUAD_ENABLE_SR2_BIT7 = 3,
+	/** Bit 1 of status register 2, read with 0x35 and written with a 2-byte
+	 * 0x01 command. */
+	FLASH_QUAD_ENABLE_SR2_BIT1 = 4,
+	/** Same as FLASH_QUAD_ENABLE_SR2_BIT1, but 1-byte 0x01 writes are safe. */
+	FLASH_QUAD_ENABLE_SR2_BIT1_NO_READ_SAFE = 5,
+	/** Bit 1 of status register 2, read with 0x35 and written with 0x31. */
+	FLASH_QUAD_ENABLE_SR2_BIT1_SEPARATE = 6,
+	/** The table didn't say, or used a reserved value. */
+	FLASH_QUAD_ENABLE_UNKNOWN = 7,
+};
+
+/** Geometry and capabilities of the flash chip.
+ *
+ * flash_init fills this with values matching the 2 MiB part the library was
+ * originally written for. flash_detect updates it from the chip's SFDP
+ * tables, if the chip has them.
+ */
+struct flash_info
+{
+	/** JEDEC manufacturer and device ID, as returned by flash_read_id. */
+	uint32_t jedec_id;
+	/** Whether the values below came from the chip's SFDP tables. */
+	bool sfdp;
+	/** Usable size of the chip in bytes. */
+	uint32_t size;
+	/** Size of a page, the largest region programmable in one command. */
+	uint32_t page_size;
+	/** Typical time to program a page, in microseconds, 0 if unknown. */
+	uint32_t page_program_us;
+	/** Typical time to erase the whole chip, in milliseconds, 0 if unknown. */
+	uint32_t chip_erase_ms;
+	/** Supported erase commands, sorted by increasing size. */
+	struct flash_erase_type erase[4];
+	/** Command used by flash_read_data. */
+	struct flash_read_mode read;
+	/** 1-1-2 fast read command. */
+	struct flash_read_mode read_1_1_2;
+	/** 1-2-2 fast read command. */
+	struct flash_read_mode read_1_2_2;
+	/** 1-1-4 fast read command. */
+	struct flash_read_mode read_1_1_4;
+	/** 1-4-4 fast read command. */
+	struct flash_read_mode read_1_4_4;
+	/** How to enable the quad data lines. */
+	enum flash_quad_enable quad_enable;
+};
+
 /** Structure representing the flash chip */
 struct flash
 {
+	/** SPI device used to talk to the chip, NULL if using the MSPI. */
 	struct spi_device *spi;
+	/** MSPI used to talk to the chip, NULL if using a SPI device. */
+	struct mspi *mspi;
+	/** Whether data reads and programs use four data lines. */
+	bool quad;
+	struct flash_info info;
 };
 
 /** Initializes the flash structure.
+ *
+ * This does not talk to the chip. The geometry in flash->info is set to
+ * defaults for a 2 MiB chip with 4 KiB sectors and 256 byte pages, see
+ * flash_detect to query the real geometry.
  *
  * @param[out] flash Flash object to initialize
  * @param[in,out] device The SPI object to use for communication with the
@@ -30,6 +123,54 @@ struct flash
  */
 void flash_init(struct flash *flash, struct spi_device *device);
 
+/** Initializes the flash structure to use the MSPI.
+ *
+ * This does not talk to the chip. flash->info is set to the same defaults as
+ * flash_init, and data is transferred over a single line until flash_detect
+ * finds the chip supports quad reads.
+ *
+ * Data reads and page programs of word-aligned buffers are done by DMA, with
+ * the core sleeping until they complete.
+ *
+ * @param[out] flash Flash object to initialize
+ * @param[in,out] mspi The MSPI object connected to the physical flash chip. It
+ *  should already be initialized.
+ */
+void flash_init_mspi(struct flash *flash, struct mspi *mspi);
+
+/** Queries the flash chip for its geometry and capabilities.
+ *
+ * This reads the JEDEC ID and parses the JESD216 SFDP basic parameter table
+ * (read with command 0x5A), updating flash->info with the density, page size,
+ * erase commands, their timings, and the fast read commands supported. If the
+ * chip has no SFDP table, flash->info keeps its defaults aside from the JEDEC
+ * ID.
+ *
+ * Only 3-byte addressing is supported, so chips larger than 16 MiB are
+ * reported as 16 MiB.
+ *
+ * If the flash was initialized with flash_init_mspi and the chip supports
+ * 1-1-4 fast reads, this also sets the chip's quad enable bit and switches
+ * data reads and page programs to four data lines.
+ *
+ * @param[in,out] flash Flash chip to query. The SPI bus or MSPI must be
+ *  enabled.
+ *
+ * @returns True if the SFDP table was found and parsed, false otherwise.
+ */
+bool flash_detect(struct flash *flash);
+
+/** Reads data from the flash chip's SFDP area.
+ *
+ * @param[in] flash Flash to read the SFDP data from.
+ * @param[in] addr SFDP address to read from.
+ * @param[out] buffer Buffer that data from the SFDP area will be written into.
+ * @param[in] size Number of bytes to read, starting at addr.
+ */
+void flash_read_sfdp(
+	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
+);
+
 /** Reads the flash chip's status register.
  *
  * @param[in] rtc Flash to read the status register from.
@@ -52,8 +193,10 @@ void flash_write_enable(struct flash *flash);
  * @param[in] addr Flash address to read from.
  * @param[out] buffer Buffer that data from flash chip will be written into.
  * @param[in] size Number of bytes to read, starting at addr.
+ *
+ * @returns 0 if the transfer failed, or 1 on success.
  */
-void flash_read_data(
+uint8_t flash_read_data(
 	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
 );
 
@@ -65,15 +208,18 @@ void flash_read_data(
  * @param[in] buffer Buffer to hold data to be written.
  * @param[in] size Number of bytes in the buffer.
  *
- * @returns 0 if chip was busy and write failed, or 1 if write command was
- * accepted.
+ * @returns 0 if chip was busy or the transfer failed, or 1 if write command
+ * was accepted.
  */
 uint8_t flash_page_program(
 	struct flash *flash, uint32_t addr, const uint8_t *buffer, uint32_t size
 );
 
 /**
- * Erases a 4K sector of the flash chip.
+ * Erases a sector of the flash chip.
+ *
+ * The sector is the smallest erase unit of the chip, flash->info.erase[0],
+ * which is 4K unless flash_detect found otherwise.
  *
  * @param[in,out] flash Flash chip that contains a sector to be erased.
  * @param[in] addr An address within the sector that will be erased.
@@ -83,6 +229,19 @@ uint8_t flash_page_program(
  */
 uint8_t flash_sector_erase(struct flash *flash, uint32_t addr);
 
+/**
+ * Erases a region of the flash chip using one of its erase commands.
+ *
+ * @param[in,out] flash Flash chip that contains the region to be erased.
+ * @param[in] addr An address within the region that will be erased.
+ * @param[in] size Size of the region, which must match the size of one of the
+ *  erase types in flash->info.erase.
+ *
+ * @returns 0 if there is no erase command for the given size, or if the chip
+ *  was busy and the erase failed, or 1 if the erase command was accepted.
+ */
+uint8_t flash_erase(struct flash *flash, uint32_t addr, uint32_t size);
+
 /**
  * Reads the device and manufacturer ID of the flash chip.
  *
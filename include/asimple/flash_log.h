@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef FLASH_LOG_H_
+#define FLASH_LOG_H_
+
+#include <flash.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef FLASH_LOG_MAX_PAGE_SIZE
+/** Size of the page buffer used to coalesce appends. Must be at least the
+ * flash page size. */
+#define FLASH_LOG_MAX_PAGE_SIZE 256
+#endif
+
+/** Circular, append-only record log stored directly on a region of flash.
+ *
+ * The region is split into sectors (the smallest erase unit of the chip). Each
+ * sector starts with a header holding a sequence number, incremented every
+ * time the log moves to a new sector, followed by records, each with its own
+ * length and CRC. Once the region fills up, the oldest sector is erased and
+ * reused, so every sector wears at the same rate.
+ *
+ * Appends are coalesced in RAM and programmed a page at a time, so
+ * flash_log_sync must be called for appended records to reach the flash.
+ *
+ * The members are private, the structure is here so it can be allocated
+ * statically.
+ */
+struct flash_log
+{
+	struct flash *flash;
+	uint32_t start;
+	uint32_t sector_size;
+	uint32_t sector_count;
+	uint32_t page_size;
+	bool empty;
+	bool busy;
+	// Sector being appended to, and where in it the next record goes
+	uint32_t head;
+	uint32_t head_seq;
+	uint32_t head_offset;
+	// Oldest sector still holding records
+	uint32_t tail;
+	uint32_t tail_seq;
+	// Data appended but not programmed yet, page_begin to page_end in the page
+	// starting at page_addr
+	uint32_t page_addr;
+	uint32_t page_begin;
+	uint32_t page_end;
+	uint8_t page[FLASH_LOG_MAX_PAGE_SIZE];
+};
+
+/** Position of a reader within a flash log. */
+struct flash_log_cursor
+{
+	/** Sequence number of the sector being read. */
+	uint32_t seq;
+	/** Offset of the next record within the sector. */
+	uint32_t offset;
+};
+
+/** Initializes the flash log and recovers its state from the flash.
+ *
+ * The newest sector is found by binary searching the sector headers, so this
+ * takes a logarithmic number of header reads plus a scan of the records in
+ * the newest sector. A region that was never used (or was erased) is an empty
+ * log.
+ *
+ * @param[out] log Flash log object to initialize.
+ * @param[in,out] flash Flash chip holding the log. flash->info must already
+ *  describe the chip, see flash_detect.
+ * @param[in] start Address of the region, aligned to flash->info.erase[0].
+ * @param[in] size Size of the region in bytes, a multiple of
+ *  flash->info.erase[0] and at least two sectors.
+ *
+ * @returns True on success, false if the region or the page size are not
+ *  usable.
+ */
+bool flash_log_init(
+	struct flash_log *log, struct flash *flash, uint32_t start, uint32_t size
+);
+
+/** Appends a record to the flash log.
+ *
+ * If the newest sector can't fit the record, the log moves to the next one,
+ * erasing the oldest sector and dropping its records if the log is full.
+ *
+ * @param[in,out] log Flash log to append to.
+ * @param[in] data Record to append.
+ * @param[in] size Size of the record, at most flash_log_max_record_size.
+ *
+ * @returns True on success, false if the record is too large or the flash
+ *  rejected a command.
+ */
+bool flash_log_append(struct flash_log *log, const void *data, uint32_t size);
+
+/** Programs any appended records still buffered in RAM, and waits for the
+ * flash to finish.
+ *
+ * @param[in,out] log Flash log to sync.
+ *
+ * @returns True on success, false if the flash rejected a command.
+ */
+bool flash_log_sync(struct flash_log *log);
+
+/** Gets the largest record the flash log can hold.
+ *
+ * @param[in] log Flash log to query.
+ *
+ * @returns The size in bytes of the largest record.
+ */
+uint32_t flash_log_max_record_size(const struct flash_log *log);
+
+/** Points a cursor at the oldest record in the flash log.
+ *
+ * @param[in] log Flash log to read.
+ * @param[out] cursor Cursor to initialize.
+ */
+void flash_log_cursor_begin(
+	const struct flash_log *log, struct flash_log_cursor *cursor
+);
+
+/** Reads the record at the cursor, and advances the cursor past it.
+ *
+ * Records that fail their CRC are skipped. If the log wrapped around and
+ * overwrote the record the cursor pointed at, reading continues from the
+ * oldest record left. Records appended but not synced yet are also read.
+ *
+ * @param[in,out] log Flash log to read.
+ * @param[in,out] cursor Position to read from.
+ * @param[out] buffer Buffer to hold the record.
+ * @param[in] size Size of the buffer.
+ *
+ * @returns The size of the record read, 0 if there are no more records, or -1
+ *  if the record doesn't fit in the buffer, in which case the cursor isn't
+ *  advanced.
+ */
+int32_t flash_log_read_from(
+	struct flash_log *log,
+	struct flash_log_cursor *cursor,
+	void *buffer,
+	uint32_t size
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // FLASH_LOG_H_
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef MSPI_H_
+#define MSPI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Opaque structure holding MSPI information and state. */
+struct mspi;
+
+/** Number of data lines used by the MSPI data transfers. */
+enum mspi_data_width
+{
+	/** Instruction, address, and data on a single line each way (1-1-1). */
+	MSPI_DATA_WIDTH_1,
+	/** Instruction and address on one line, data on four lines (1-1-4). */
+	MSPI_DATA_WIDTH_4,
+};
+
+/** Gets the MSPI instance.
+ *
+ * The Apollo3 has a single MSPI module, connected to a flash chip on chip
+ * select 0. The device is configured in SPI mode 0, with 3-byte addressing
+ * and 1-byte instructions. The hardware pins used are described by the
+ * AM_BSP_GPIO_MSPI_* defines in the BSP.
+ *
+ * On initialization, the hardware is set to sleep-- call mspi_enable to turn
+ * on the hardware. This tracks how many times the instance has been borrowed.
+ *
+ * @param[in] clock The clock speed in Hz. The actual clock will be rounded
+ *  down to the closest supported one, with 3 MHz being the slowest.
+ *
+ * @returns A pointer to the MSPI instance, or NULL if the hardware could not
+ *  be initialized.
+ */
+struct mspi *mspi_get_instance(uint32_t clock);
+
+/** Releases all resources of the given MSPI object, once all borrowed
+ * instances are returned.
+ *
+ * @param[in,out] mspi MSPI object to deinitialize.
+ */
+void mspi_deinitialize(struct mspi *mspi);
+
+/** Enables/wakes up the MSPI module.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to enable.
+ *
+ * @returns True on success, false if it cannot be enabled. This usually
+ *  happens if the device is already awake.
+ */
+bool mspi_enable(struct mspi *mspi);
+
+/** Places the MSPI module to sleep.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to set to sleep.
+ *
+ * @returns True on success, false if it cannot be put to sleep.
+ */
+bool mspi_sleep(struct mspi *mspi);
+
+/** Sends a command and reads its response (blocking), using a single data
+ *  line each way.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to use.
+ * @param[in] command Instruction byte to send.
+ * @param[in] send_address Whether to send a 3-byte address after the
+ *  instruction.
+ * @param[in] address Address to send, if send_address is true.
+ * @param[in] dummy_clocks Number of clocks to wait between the address and
+ *  the response.
+ * @param[out] buffer Buffer to hold the response.
+ * @param[in] size Number of bytes to read.
+ */
+void mspi_command_read(
+	struct mspi *mspi, uint8_t command, bool send_address, uint32_t address,
+	uint8_t dummy_clocks, uint8_t *buffer, uint32_t size
+);
+
+/** Sends a command followed by data (blocking), using a single data line.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to use.
+ * @param[in] command Instruction byte to send.
+ * @param[in] send_address Whether to send a 3-byte address after the
+ *  instruction.
+ * @param[in] address Address to send, if send_address is true.
+ * @param[in] buffer Data to send after the instruction and address, may be
+ *  NULL if size is 0.
+ * @param[in] size Number of bytes to send.
+ */
+void mspi_command_write(
+	struct mspi *mspi, uint8_t command, bool send_address, uint32_t address,
+	const uint8_t *buffer, uint32_t size
+);
+
+/** Configures the commands used by mspi_data_read and mspi_data_write.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to modify.
+ * @param[in] width Number of lines to transfer the data over.
+ * @param[in] read_command Instruction used to read data.
+ * @param[in] read_dummy_clocks Clocks between the address and the data when
+ *  reading, including any mode clocks.
+ * @param[in] write_command Instruction used to write data.
+ */
+void mspi_configure_data(
+	struct mspi *mspi, enum mspi_data_width width, uint8_t read_command,
+	uint8_t read_dummy_clocks, uint8_t write_command
+);
+
+/** Reads data (blocking) from the device using the configured data read
+ *  command.
+ *
+ * Word-aligned buffers are transferred by DMA, and the core sleeps until the
+ * transfer completes. Other buffers go through PIO, a few words at a time,
+ * without allocating.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to use.
+ * @param[in] address Device address to read from.
+ * @param[out] buffer Buffer to hold the data read.
+ * @param[in] size Number of bytes to read.
+ *
+ * @returns True on success, false if a transfer failed.
+ */
+bool mspi_data_read(
+	struct mspi *mspi, uint32_t address, uint8_t *buffer, uint32_t size
+);
+
+/** Writes data (blocking) to the device using the configured data write
+ *  command.
+ *
+ * Word-aligned buffers are transferred by DMA, and the core sleeps until the
+ * transfer completes. Other buffers go through PIO, a few words at a time,
+ * without allocating.
+ *
+ * @param[in,out] mspi Pointer to the MSPI structure to use.
+ * @param[in] address Device address to write to.
+ * @param[in] buffer Data to write.
+ * @param[in] size Number of bytes to write.
+ *
+ * @returns True on success, false if a transfer failed.
+ */
+bool mspi_data_write(
+	struct mspi *mspi, uint32_t address, const uint8_t *buffer, uint32_t size
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MSPI_H_
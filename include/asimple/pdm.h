@@ -8,7 +8,9 @@
 #define PDM_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <telemetry.h>
 #include <uart.h>
 
 #ifdef __cplusplus
@@ -19,9 +21,61 @@ extern "C"
 #define PDM_SIZE 4096
 #define PDM_BYTES (PDM_SIZE * 2)
 
+#ifndef PDM_TELEMETRY_CHANNEL
+/** Telemetry channel used by pcm_send. */
+#define PDM_TELEMETRY_CHANNEL 0xA0
+#endif
+
+/** Largest number of PCM bytes pcm_send puts in a frame, so that every frame
+ * fits in the telemetry staging buffer. A multiple of 4, so frames always
+ * hold whole stereo samples. */
+#define PDM_TELEMETRY_FRAME_BYTES 480
+
 /** Opaque structure representing the microphone */
 struct pdm;
 
+/** Channels captured from the microphones. */
+enum pdm_channels
+{
+	PDM_CHANNEL_LEFT,
+	PDM_CHANNEL_RIGHT,
+	/** Both channels, samples are interleaved left then right. */
+	PDM_CHANNEL_STEREO,
+};
+
+/** Highest gain accepted by pdm_configure, in tenths of a dB. */
+#define PDM_MAX_GAIN 405
+
+/** Highest high-pass filter cutoff setting accepted by pdm_configure. */
+#define PDM_MAX_HIGH_PASS_CUTOFF 0xF
+
+/** Settings of the PDM, see pdm_configure. */
+struct pdm_config
+{
+	/** PCM sample rate, in Hz. */
+	uint32_t sample_rate;
+	/** Gain of both channels in tenths of a dB, from 0 to PDM_MAX_GAIN, rounded
+	 * to the nearest 1.5 dB step. */
+	uint16_t gain;
+	/** Whether the high-pass filter removing DC is enabled. */
+	bool high_pass;
+	/** High-pass filter cutoff setting, up to PDM_MAX_HIGH_PASS_CUTOFF. This
+	 * is the raw HPCUTOFF field, see the datasheet. */
+	uint8_t high_pass_cutoff;
+	/** Channels to capture. */
+	enum pdm_channels channels;
+};
+
+/** Settings the PDM starts with: about 7.8 kHz, +40.5 dB, right channel. */
+#define PDM_CONFIG_DEFAULT                                                     \
+	((struct pdm_config){                                                      \
+		.sample_rate = 7812,                                                   \
+		.gain = PDM_MAX_GAIN,                                                  \
+		.high_pass = false,                                                    \
+		.high_pass_cutoff = 0xB,                                               \
+		.channels = PDM_CHANNEL_RIGHT,                                         \
+	})
+
 /**
  * Get the PDM instance.
  *
@@ -55,6 +109,35 @@ bool pdm_sleep(struct pdm *pdm);
  */
 void pdm_deinitialize(struct pdm *pdm);
 
+/**
+ * Configures the sample rate, gain, high-pass filter, and channels.
+ *
+ * The PDM clock, clock divider, and decimation rate are picked to get as close
+ * as possible to the requested sample rate, preferring a higher decimation
+ * rate (more oversampling) and then a lower PDM clock when several are as
+ * close.
+ *
+ * If the PDM is asleep, the settings are applied by pdm_enable, as the
+ * hardware can't be touched until then.
+ *
+ * @param[in,out] pdm PDM structure to configure.
+ * @param[in] config New settings.
+ *
+ * @returns The sample rate reached in mHz, or 0 if the settings are invalid,
+ *  the sample rate can't be reached, or the PDM is streaming. The previous
+ *  settings are kept on failure.
+ */
+uint32_t pdm_configure(struct pdm *pdm, const struct pdm_config *config);
+
+/**
+ * Gets the sample rate the PDM is configured for.
+ *
+ * @param[in] pdm PDM structure to query.
+ *
+ * @returns The sample rate in mHz.
+ */
+uint32_t pdm_get_sample_rate(const struct pdm *pdm);
+
 /**
  * Get g_ui32PDMDataBuffer1 from the PDM struct.
  *
@@ -88,14 +171,96 @@ void pdm_flush(struct pdm *pdm);
  */
 void pdm_data_get(struct pdm *pdm, uint32_t *g_ui32PDMDataBuffer);
 
+/** Function called by the PDM interrupt every time a stream buffer is full.
+ *
+ * This runs in interrupt context, while DMA fills the other buffer, so it must
+ * be done with the samples (e.g. copy them out, or queue them for processing)
+ * before that buffer is full too.
+ *
+ * @param[in,out] context Context given to pdm_stream_start.
+ * @param[in] samples PCM samples, interleaved left and right when both
+ *  channels are captured.
+ * @param[in] count Number of samples.
+ */
+typedef void (*pdm_stream_callback)(
+	void *context, const int16_t *samples, size_t count
+);
+
+/** Statistics kept while streaming. */
+struct pdm_stream_stats
+{
+	/** Number of buffers handed to the callback. */
+	uint32_t buffers;
+	/** Number of DMA errors, the buffer being filled is dropped. */
+	uint32_t dma_errors;
+	/** Number of times the PDM FIFO overflowed and samples were lost. */
+	uint32_t fifo_overflows;
+};
+
+/**
+ * Starts capturing continuously into the two PDM buffers using DMA.
+ *
+ * When a buffer is full, the interrupt moves DMA on to the other buffer
+ * before calling the callback with the full one, so no samples are lost
+ * between buffers. Each buffer holds PDM_BYTES of samples.
+ *
+ * The PDM must be enabled. pdm_data_get and isPDMDataReady must not be used
+ * while streaming.
+ *
+ * @param[in,out] pdm PDM structure to use.
+ * @param[in] callback Function called with every full buffer.
+ * @param[in,out] context Passed to callback.
+ *
+ * @returns True on success, false if there is no callback or the PDM is
+ *  already streaming.
+ */
+bool pdm_stream_start(
+	struct pdm *pdm, pdm_stream_callback callback, void *context
+);
+
+/**
+ * Stops streaming. Samples in the buffer being filled are discarded.
+ *
+ * @param[in,out] pdm PDM structure to use.
+ */
+void pdm_stream_stop(struct pdm *pdm);
+
+/**
+ * Gets the statistics of the current or last stream.
+ *
+ * @param[in] pdm PDM structure to query.
+ * @param[out] stats Statistics, reset by pdm_stream_start.
+ */
+void pdm_stream_get_stats(
+	const struct pdm *pdm, struct pdm_stream_stats *stats
+);
+
 /**
  * Print the DMA data from the microhpone to UART.
  *
+ * The PCM bytes are sent raw, with no framing, for existing scripts reading
+ * them straight off the serial port. A receiver that connects mid-stream or
+ * misses a byte can't find sample boundaries again, see pcm_send.
+ *
  * @param[in] uart UART structure to sned the data to.
  * @param[in] g_ui32PDMDataBuffer buffer array of the data we're sending.
  */
 void pcm_print(struct uart *uart, uint32_t *g_ui32PDMDataBuffer);
 
+/**
+ * Sends PCM samples as telemetry frames on channel PDM_TELEMETRY_CHANNEL.
+ *
+ * The samples are split into frames of up to PDM_TELEMETRY_FRAME_BYTES, each
+ * with its own CRC, so host/telemetry_decode can resynchronize after any
+ * corruption and write the samples out to their own file.
+ *
+ * @param[in,out] telemetry Telemetry transport to send the samples on.
+ * @param[in] samples PCM samples, e.g. a PDM buffer filled by pdm_data_get or
+ *  handed to a pdm_stream_callback.
+ * @param[in] size Size of the samples in bytes, e.g. PDM_BYTES.
+ */
+void pcm_send(struct telemetry *telemetry, const void *samples, size_t size);
+
 /**
  * Return whether PDM data is ready to be printed.
  *
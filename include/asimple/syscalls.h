@@ -9,6 +9,9 @@
 #include <asimple_littlefs.h>
 #include <uart.h>
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -33,14 +36,99 @@ void syscalls_rtc_init(struct am1815 *rtc);
  */
 void syscalls_uart_init(struct uart *uart);
 
-/** Links the given UART object with stdin, stdout, and stderr.
+/** When writes to the console UART wait for the data to go out on the wire. */
+enum syscalls_uart_sync_mode
+{
+	/** Every write waits until the UART is done transmitting. */
+	SYSCALLS_UART_SYNC_ALL,
+	/** Only writes to stderr wait, stdout returns as soon as the data is
+	 * queued in the UART TX buffer. */
+	SYSCALLS_UART_SYNC_STDERR,
+	/** No write waits, call syscalls_uart_flush (after fflush, if stdio is
+	 * buffering) when the output has to be on the wire. */
+	SYSCALLS_UART_SYNC_NONE,
+};
+
+/** What writes do when the UART TX buffer is full. */
+enum syscalls_uart_full_policy
+{
+	/** Sleep until the UART makes room for the rest of the data. */
+	SYSCALLS_UART_FULL_BLOCK,
+	/** Drop whatever doesn't fit, and return immediately. */
+	SYSCALLS_UART_FULL_DROP,
+};
+
+/** Counters for console UART writes. */
+struct syscalls_uart_stats
+{
+	/** Bytes queued for transmission. */
+	uint32_t written;
+	/** Bytes dropped because the TX buffer was full. */
+	uint32_t dropped;
+	/** Bytes that had to wait for room in the TX buffer. */
+	uint32_t blocked;
+	/** Number of times a write had to wait for room in the TX buffer. */
+	uint32_t blocks;
+};
+
+/** Configures how console writes behave.
  *
- * @param[in,out] uart UART object to use for system console IO.
+ * The default is SYSCALLS_UART_SYNC_ALL with SYSCALLS_UART_FULL_BLOCK, where
+ * every write returns only after the data is out of the UART.
  *
- * @post stdio functions like printf should work.
+ * @param[in] mode Which writes wait for the data to be transmitted.
+ * @param[in] policy What to do when the TX buffer is full.
+ */
+void syscalls_uart_configure(
+	enum syscalls_uart_sync_mode mode, enum syscalls_uart_full_policy policy
+);
+
+/** Blocks until everything written to the console UART is transmitted. */
+void syscalls_uart_flush(void);
+
+/** Gets the console UART write counters.
+ *
+ * @param[out] stats Where to copy the counters to.
+ */
+void syscalls_uart_get_stats(struct syscalls_uart_stats *stats);
+
+/** Mounts the given littlefs filesystem at "fs:/".
+ *
+ * Equivalent to syscalls_littlefs_mount("fs:", fs).
+ *
+ * @param[in,out] fs Mounted littlefs filesystem to use.
+ *
+ * @post open and stat work for paths starting with "fs:/".
  */
 void syscalls_littlefs_init(struct asimple_littlefs *fs);
 
+/** Mounts the given littlefs filesystem at the given prefix.
+ *
+ * Several filesystems can be mounted at once, e.g. "flash:" and "sd:", and
+ * files on all of them can be open at the same time.
+ *
+ * @param[in] prefix Prefix to mount the filesystem at, e.g. "flash:".
+ * @param[in,out] fs Mounted littlefs filesystem to use.
+ *
+ * @returns True on success, false if the prefix is invalid or in use, or if
+ *  there is no room for another mount.
+ *
+ * @post open and stat work for paths starting with the prefix and a slash.
+ */
+bool syscalls_littlefs_mount(const char *prefix, struct asimple_littlefs *fs);
+
+/** Unmounts the given littlefs filesystem from the syscalls.
+ *
+ * Files still open on the filesystem must be closed first, otherwise nothing
+ * is unmounted.
+ *
+ * @param[in] fs Filesystem to unmount.
+ *
+ * @returns True on success, false with errno set to EBUSY if files are still
+ *  open on the filesystem.
+ */
+bool syscalls_littlefs_unmount(struct asimple_littlefs *fs);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
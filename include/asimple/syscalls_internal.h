@@ -12,6 +12,8 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -36,6 +38,21 @@ struct syscalls_base
 	int (*stat)(void *context, const char *filename, struct stat *st);
 };
 
+#ifndef SYSCALLS_MAX_FILES
+/** Number of file descriptors, including stdin, stdout, and stderr. */
+#define SYSCALLS_MAX_FILES 16
+#endif
+
+#ifndef SYSCALLS_MAX_MOUNTS
+/** Number of filesystems that can be mounted at the same time. */
+#define SYSCALLS_MAX_MOUNTS 4
+#endif
+
+#ifndef SYSCALLS_MAX_PREFIX
+/** Longest mount prefix, not counting the trailing slash. */
+#define SYSCALLS_MAX_PREFIX 7
+#endif
+
 ///{
 /** The following functions are used to register devices with specific
  * syscalls. These are called internally by asimple.
@@ -44,7 +61,29 @@ void syscalls_register_rtc(void *device);
 void syscalls_register_stdin(void *device);
 void syscalls_register_stdout(void *device);
 void syscalls_register_stderr(void *device);
-void syscalls_register_fs(void *device);
+
+/** Mounts a filesystem device at the given prefix.
+ *
+ * Paths starting with the prefix followed by a slash are routed to the device,
+ * with the prefix removed, e.g. "flash:/log.txt" becomes "/log.txt" for a
+ * device mounted at "flash:".
+ *
+ * @param[in] prefix Prefix to mount the device at, e.g. "flash:". A trailing
+ *  slash is ignored.
+ * @param[in,out] device Device to mount.
+ *
+ * @returns True on success, false if the prefix is invalid or already in use,
+ *  or if there is no room for another mount.
+ */
+bool syscalls_register_mount(const char *prefix, void *device);
+
+/** Unmounts a filesystem device from every prefix it is mounted at.
+ *
+ * Files already open on the device stay open.
+ *
+ * @param[in] device Device to unmount.
+ */
+void syscalls_unregister_mount(void *device);
 
 ///}
 
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+/// @file
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <uart.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef TELEMETRY_BUFFER_SIZE
+/** Size of the buffer frames are encoded into before being queued on the
+ * UART. Must be larger than 256 bytes. */
+#define TELEMETRY_BUFFER_SIZE 512
+#endif
+
+/** Framed binary transport over a UART.
+ *
+ * Every frame carries a channel ID, the payload, and a CRC-32 of both (little
+ * endian), and is COBS encoded and terminated by a zero byte. Since zero bytes
+ * only ever appear between frames, a receiver can resynchronize at the next
+ * zero after any corruption or after connecting mid-stream. See
+ * host/telemetry_decode.c for a decoder.
+ *
+ * The members are private, the structure is here so it can be allocated
+ * statically.
+ */
+struct telemetry
+{
+	struct uart *uart;
+	uint32_t frames;
+	uint32_t waits;
+	// Encoded bytes not queued on the UART yet, and where the COBS code byte
+	// of the current block goes
+	size_t length;
+	size_t code_index;
+	uint8_t code;
+	uint8_t buffer[TELEMETRY_BUFFER_SIZE];
+};
+
+/** Counters for a telemetry transport. */
+struct telemetry_stats
+{
+	/** Number of frames sent. */
+	uint32_t frames;
+	/** Number of times sending had to wait for room in the UART TX buffer. */
+	uint32_t waits;
+};
+
+/** Initializes the telemetry transport.
+ *
+ * @param[out] telemetry Telemetry object to initialize.
+ * @param[in,out] uart UART to send frames over. It should not be used for
+ *  anything else, as other data would corrupt the frames around it.
+ */
+void telemetry_init(struct telemetry *telemetry, struct uart *uart);
+
+/** Sends a frame.
+ *
+ * The frame is queued into the UART TX buffer in large chunks, and this
+ * sleeps while the TX buffer is full. It returns once the whole frame is
+ * queued, not once it has been transmitted, see uart_sync.
+ *
+ * @param[in,out] telemetry Telemetry transport to send the frame on.
+ * @param[in] channel Channel ID, for the receiver to tell streams apart.
+ * @param[in] data Payload of the frame.
+ * @param[in] size Size of the payload in bytes.
+ */
+void telemetry_send(
+	struct telemetry *telemetry,
+	uint8_t channel,
+	const void *data,
+	size_t size
+);
+
+/** Changes the baud rate of the UART under the telemetry transport.
+ *
+ * Frames already queued are transmitted at the old baud rate first. The
+ * receiving end must switch at the same time, any frame caught in between is
+ * dropped by the receiver when its CRC fails.
+ *
+ * @param[in,out] telemetry Telemetry transport to update.
+ * @param[in] baud_rate Desired baud rate.
+ *
+ * @returns True on success, false if the UART can't run at the requested baud
+ *  rate, in which case the previous baud rate is kept.
+ */
+bool telemetry_set_baud_rate(
+	struct telemetry *telemetry, unsigned int baud_rate
+);
+
+/** Gets the counters of a telemetry transport.
+ *
+ * @param[in] telemetry Telemetry transport to query.
+ * @param[out] stats Where to copy the counters to.
+ */
+void telemetry_get_stats(
+	const struct telemetry *telemetry, struct telemetry_stats *stats
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // TELEMETRY_H_
@@ -5,6 +5,9 @@
 #ifndef UART_H_
 #define UART_H_
 
+#include <am_mcu_apollo.h>
+
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -24,6 +27,33 @@ enum uart_instance
 	UART_INST1 = 1
 };
 
+#ifndef UART_DEFAULT_TX_BUFFER_SIZE
+/** Size of the TX buffer allocated when the caller doesn't provide one. */
+#define UART_DEFAULT_TX_BUFFER_SIZE 1024
+#endif
+
+#ifndef UART_DEFAULT_RX_BUFFER_SIZE
+/** Size of the RX buffer allocated when the caller doesn't provide one. */
+#define UART_DEFAULT_RX_BUFFER_SIZE 1024
+#endif
+
+/** Buffers used by a UART instance to queue data to send and received data.
+ *
+ * A NULL buffer is allocated with the given size, and a size of zero means the
+ * default size. The buffers must stay valid until the UART is deinitialized.
+ */
+struct uart_buffers
+{
+	/** TX buffer, or NULL to allocate one. */
+	uint8_t *tx;
+	/** Size of the TX buffer. */
+	size_t tx_size;
+	/** RX buffer, or NULL to allocate one. One byte is always unused. */
+	uint8_t *rx;
+	/** Size of the RX buffer. */
+	size_t rx_size;
+};
+
 /** Gets the requested UART structure.
  *
  * The first time this is called (from boot or after a disable) this
@@ -31,10 +61,15 @@ enum uart_instance
  * initialization). This tracks how many times it's been borrowed.
  *
  * @param[in] instance UART instance to assign to UART structure.
+ * @param[in] buffers Buffers to use, or NULL to allocate buffers of the default
+ *  sizes. Only used when the UART is initialized, ignored otherwise.
  *
- * @returns Opaque pointer to UART instance.
+ * @returns Opaque pointer to UART instance, or NULL if the buffers could not
+ *  be allocated.
  */
-struct uart *uart_get_instance(enum uart_instance instance);
+struct uart *uart_get_instance(
+	enum uart_instance instance, const struct uart_buffers *buffers
+);
 
 /** Deinitializes the given UART structure, freeing resources held, including
  * the associated UART instance, once all users have deinitialized it.
@@ -71,30 +106,243 @@ bool uart_sleep(struct uart *uart);
  */
 size_t uart_write(struct uart *uart, const unsigned char *data, size_t size);
 
-/** Receives data over UART.
+/** Sends the whole buffer over UART, sleeping while the TX buffer is full.
+ *
+ * Data is queued into the TX buffer in as few chunks as possible, and the
+ * processor is put to (normal) sleep while the TX interrupt makes room.
+ *
+ * @param[in,out] uart
+ * @param[in] data Buffer to write.
+ * @param[in] size Size of buffer to write.
+ *
+ * @returns The number of times this had to wait for room in the TX buffer.
+ */
+size_t
+uart_write_all(struct uart *uart, const unsigned char *data, size_t size);
+
+/** Receives data over UART, without blocking.
+ *
+ * Received data is moved by the UART interrupt into an RX buffer, this reads
+ * from that buffer. While the RX buffer is full, data is left in the RX FIFO,
+ * so with flow control the other end is told to wait, and without it data is
+ * lost once the FIFO overruns, see uart_get_error_stats.
  *
  * @param[in,out] uart
  * @param[in] data Buffer to read into.
  * @param[in] size Size of buffer to read into.
  *
  * @returns The number of bytes read, which may be less than the size of the
- *  buffer.
+ *  buffer, or zero if no data is available.
  */
 size_t uart_read(struct uart *uart, unsigned char *data, size_t size);
 
+/** Timeout for uart_read_timeout to wait until data arrives. */
+#define UART_TIMEOUT_FOREVER UINT32_MAX
+
+/** Receives data over UART, sleeping until some is available.
+ *
+ * The processor is put to (normal) sleep while waiting, and the UART
+ * interrupt wakes it up when data arrives. The timeout is measured with
+ * systick if it is running, otherwise this polls every millisecond.
+ *
+ * @param[in,out] uart
+ * @param[in] data Buffer to read into.
+ * @param[in] size Size of buffer to read into.
+ * @param[in] timeout_ms Milliseconds to wait for data, 0 to not wait at all,
+ *  or UART_TIMEOUT_FOREVER to wait until data arrives.
+ *
+ * @returns The number of bytes read, which may be less than the size of the
+ *  buffer, or zero if the timeout expired.
+ */
+size_t uart_read_timeout(
+	struct uart *uart, unsigned char *data, size_t size, uint32_t timeout_ms
+);
+
+/** Gets the number of received bytes waiting to be read.
+ *
+ * @param[in] uart
+ *
+ * @returns The number of bytes that uart_read can return right away.
+ */
+size_t uart_rx_available(struct uart *uart);
+
+/** Parity bit settings. */
+enum uart_parity
+{
+	UART_PARITY_NONE,
+	UART_PARITY_ODD,
+	UART_PARITY_EVEN,
+};
+
+/** Hardware flow control settings. */
+enum uart_flow_control
+{
+	UART_FLOW_CONTROL_NONE,
+	/** RTS is deasserted when the RX FIFO fills up, and data is only sent
+	 * while CTS is asserted. */
+	UART_FLOW_CONTROL_RTS_CTS,
+	/** Only RTS is used. */
+	UART_FLOW_CONTROL_RTS,
+	/** Only CTS is used. */
+	UART_FLOW_CONTROL_CTS,
+};
+
+/** FIFO fill levels at which the UART interrupts. The FIFOs are 32 bytes. */
+enum uart_fifo_level
+{
+	UART_FIFO_1_8,
+	UART_FIFO_1_4,
+	UART_FIFO_1_2,
+	UART_FIFO_3_4,
+	UART_FIFO_7_8,
+};
+
+/** UART line and FIFO settings. Data is always 8 bits. */
+struct uart_config
+{
+	/** Baud rate, see uart_set_baud_rate for the limits. */
+	unsigned int baud_rate;
+	/** Parity bit. */
+	enum uart_parity parity;
+	/** Whether to use two stop bits instead of one. */
+	bool two_stop_bits;
+	/** Hardware flow control. The RTS and CTS signals must be routed to pins,
+	 * see uart_set_pins. */
+	enum uart_flow_control flow_control;
+	/** Level at which the TX FIFO asks for more data. Lower levels mean fewer
+	 * interrupts, higher levels more margin before the line goes idle. */
+	enum uart_fifo_level tx_fifo_level;
+	/** Level at which the RX FIFO interrupts. Lower levels leave more margin
+	 * before the FIFO overruns, higher levels mean fewer interrupts. */
+	enum uart_fifo_level rx_fifo_level;
+};
+
+/** A pin carrying a UART signal. */
+struct uart_pin
+{
+	/** Pin number, or -1 if the signal isn't used. */
+	int pin;
+	/** Pad configuration selecting the UART function of the pin, e.g. with
+	 * uFuncSel set to AM_HAL_PIN_48_UART0TX. Must stay valid while the UART
+	 * uses it. */
+	const am_hal_gpio_pincfg_t *config;
+};
+
+/** Pins used by a UART instance.
+ *
+ * UART0 starts with the TX and RX pins the board routes to its USB serial
+ * converter. UART1 starts with the pins the BSP defines for it
+ * (AM_BSP_GPIO_UART1_TX and AM_BSP_GPIO_UART1_RX), if any, otherwise it needs
+ * pins set before it is enabled. RTS and CTS start unused.
+ */
+struct uart_pins
+{
+	struct uart_pin tx;
+	struct uart_pin rx;
+	struct uart_pin rts;
+	struct uart_pin cts;
+};
+
+/** Counters of receive errors reported by the UART. */
+struct uart_error_stats
+{
+	/** Data was lost because the RX FIFO was full. */
+	uint32_t overruns;
+	/** A byte was received without a valid stop bit. */
+	uint32_t framing_errors;
+	/** A byte was received with the wrong parity. */
+	uint32_t parity_errors;
+	/** The RX line was held low for longer than a byte. */
+	uint32_t breaks;
+};
+
+/** Changes the UART settings.
+ *
+ * The UART starts as 115200-8-N-1, without flow control, and with both FIFOs
+ * interrupting at half full. This blocks until any data queued is transmitted
+ * with the old settings.
+ *
+ * @param[in,out] uart Uart instance to update.
+ * @param[in] config Settings to use.
+ *
+ * @returns True on success, false if the settings are invalid or the UART
+ *  can't run at the requested baud rate, in which case the previous settings
+ *  are kept.
+ */
+bool uart_set_config(struct uart *uart, const struct uart_config *config);
+
+/** Gets the UART settings.
+ *
+ * @param[in] uart
+ * @param[out] config Where to copy the settings to.
+ */
+void uart_get_config(struct uart *uart, struct uart_config *config);
+
+/** Sets the pins used by a UART instance.
+ *
+ * Pins are configured by uart_enable and released by uart_sleep, so this must
+ * be called while the UART is asleep, e.g. right after uart_get_instance. Each
+ * instance has its own pins, so both UARTs can run at the same time.
+ *
+ * @param[in,out] uart UART instance to update.
+ * @param[in] pins Pins to use from the next uart_enable on.
+ */
+void uart_set_pins(struct uart *uart, const struct uart_pins *pins);
+
+/** Gets the pins used by a UART instance.
+ *
+ * @param[in] uart
+ * @param[out] pins Where to copy the pins to.
+ */
+void uart_get_pins(struct uart *uart, struct uart_pins *pins);
+
+/** Gets the counters of receive errors since the UART was initialized.
+ *
+ * @param[in] uart
+ * @param[out] stats Where to copy the counters to.
+ */
+void uart_get_error_stats(struct uart *uart, struct uart_error_stats *stats);
+
 /** Sets the UART baud rate to the requested amount.
  *
  * Note that in reality, there is an upper limit to the baud rate. For Apollo3
- * A1, 921600, for Apollo3 B0, 1500000. FIXME currently this function hangs if
- * a bad baud rate is given.
+ * A1, 921600, for Apollo3 B0, 1500000. This blocks until any data queued is
+ * transmitted at the old baud rate.
  *
  * @param[in,out] uart Uart instance to update.
  * @param[in] baud_rate Desired baud rate.
+ *
+ * @returns True on success, false if the UART can't run at the requested baud
+ *  rate, in which case the previous baud rate is kept.
+ */
+bool uart_set_baud_rate(struct uart *uart, unsigned int baud_rate);
+
+/** Gets the UART baud rate.
+ *
+ * @param[in] uart
+ *
+ * @returns The baud rate the UART is configured for.
  */
-void uart_set_baud_rate(struct uart *uart, unsigned int baud_rate);
+unsigned int uart_get_baud_rate(struct uart *uart);
 
 // FIXME what about RX and TX functions?
 
+/** Gets the size of the TX buffer.
+ *
+ * @param[in] uart
+ *
+ * @returns The size of the TX buffer in bytes.
+ */
+size_t uart_tx_buffer_size(struct uart *uart);
+
+/** Gets the size of the RX buffer.
+ *
+ * @param[in] uart
+ *
+ * @returns The size of the RX buffer in bytes.
+ */
+size_t uart_rx_buffer_size(struct uart *uart);
+
 /** Blocks until UART is done transmitting.
  *
  * @param[in] uart UART instance to block on.
@@ -7,15 +7,48 @@
 #include <adc.h>
 
 #include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
 
+struct adc_timer_clock;
+
+// Number of ADC channels, and the value marking channels without slots and
+// pins without channels
+#define ADC_CHANNELS (AM_HAL_ADC_SLOT_CHSEL_VSS + 1)
+#define ADC_NO_SLOT 0xFF
+#define ADC_NO_CHANNEL 0xFF
+
 struct adc
 {
 	void *handle;
 	uint8_t slots_configured;
 	am_hal_adc_slot_chan_e
 		slot_channels[8]; // actually an am_hal_adc_slot_chan_e
+	uint8_t channel_slots[ADC_CHANNELS]; // inverse of slot_channels
+	struct adc_slot_config slot_settings[8];
+	am_hal_adc_config_t config;
 	atomic_uint refcount;
+
+	// Streaming state, used by the interrupt
+	uint32_t *stream_buffers[2];
+	size_t stream_count;
+	unsigned stream_index; // buffer DMA is filling
+	adc_stream_callback stream_callback;
+	void *stream_context;
+	struct adc_stream_stats stream_stats;
+	volatile bool streaming;
+	bool stream_timed; // the stream started timed sampling, and ends it
+
+	// Window comparator events, and the window interrupt armed next
+	adc_window_callback window_inside;
+	adc_window_callback window_outside;
+	void *window_context;
+	uint32_t window_interrupts;
+
+	// Timed sampling, scans triggered by timer 3
+	const struct adc_timer_clock *timer_clock;
+	uint32_t timer_period;
+	bool timed;
 };
 
 static struct adc adc_;
@@ -28,6 +61,9 @@ static struct adc adc_;
  * - Internal 2.0V reference
  * - High power CLKMODE (remains active between samples)
  * - High power mode (low latency when triggering new sample)
+ *
+ * This is only the initial configuration, see adc_set_power_mode and
+ * adc_set_sample_rate.
  */
 static const am_hal_adc_config_t adc_config = {
 	.eClock = AM_HAL_ADC_CLKSEL_HFRC,
@@ -39,12 +75,171 @@ static const am_hal_adc_config_t adc_config = {
 	.eRepeat = AM_HAL_ADC_SINGLE_SCAN
 };
 
+// Clock and power modes behind every adc_power_mode
+static const struct
+{
+	am_hal_adc_clkmode_e clock_mode;
+	am_hal_adc_lpmode_e power_mode;
+} adc_power_modes[] = {
+	[ADC_POWER_LOW_LATENCY] =
+		{AM_HAL_ADC_CLKMODE_LOW_LATENCY, AM_HAL_ADC_LPMODE0},
+	[ADC_POWER_GATED_CLOCK] =
+		{AM_HAL_ADC_CLKMODE_LOW_POWER, AM_HAL_ADC_LPMODE0},
+	[ADC_POWER_DOWN_BETWEEN_SCANS] =
+		{AM_HAL_ADC_CLKMODE_LOW_POWER, AM_HAL_ADC_LPMODE1},
+};
+
+static const struct adc_slot_config adc_default_slot = {
+	.precision = 14,
+	.averages = 1,
+	.window_compare = true,
+};
+
+static bool adc_precision_mode(uint8_t bits, am_hal_adc_slot_prec_e *mode)
+{
+	switch (bits)
+	{
+	case 14:
+		*mode = AM_HAL_ADC_SLOT_14BIT;
+		return true;
+	case 12:
+		*mode = AM_HAL_ADC_SLOT_12BIT;
+		return true;
+	case 10:
+		*mode = AM_HAL_ADC_SLOT_10BIT;
+		return true;
+	case 8:
+		*mode = AM_HAL_ADC_SLOT_8BIT;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool adc_averaging_mode(uint8_t averages, am_hal_adc_meas_avg_e *mode)
+{
+	// The averaging modes go from 1 to 128 measurements in powers of two
+	for (unsigned i = 0; i <= 7; ++i)
+	{
+		if (averages == 1u << i)
+		{
+			*mode = (am_hal_adc_meas_avg_e)(AM_HAL_ADC_SLOT_AVG_1 + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Builds the HAL configuration of an enabled slot, from its channel and
+// settings
+static am_hal_adc_slot_config_t
+adc_slot_hal_config(const struct adc *adc, uint8_t slot)
+{
+	am_hal_adc_slot_config_t slot_config = {
+		.bEnabled = true,
+		.bWindowCompare = adc->slot_settings[slot].window_compare,
+		.eChannel = adc->slot_channels[slot],
+		.eMeasToAvg = AM_HAL_ADC_SLOT_AVG_1,
+		.ePrecisionMode = AM_HAL_ADC_SLOT_14BIT,
+	};
+	// Settings are validated when they are set
+	adc_precision_mode(
+		adc->slot_settings[slot].precision, &slot_config.ePrecisionMode
+	);
+	adc_averaging_mode(
+		adc->slot_settings[slot].averages, &slot_config.eMeasToAvg
+	);
+	return slot_config;
+}
+
 // ADC handle used by the interrupt, registered by adc_init
 // This is a volatile pointer, as it is set by a function outside the ISR (and
 // while extremely not recommended, can be changed by said function between ISR
 // calls)
 static void *volatile interrupt_adc_handle;
 
+// Points DMA at the given stream buffer
+static bool adc_stream_arm(struct adc *adc, unsigned index)
+{
+	am_hal_adc_dma_config_t dma_config = {
+		.bDynamicPriority = true,
+		.ePriority = AM_HAL_ADC_PRIOR_SERVICE_IMMED,
+		.bDMAEnable = true,
+		.ui32SampleCount = adc->stream_count,
+		.ui32TargetAddress = (uintptr_t)adc->stream_buffers[index],
+	};
+	adc->stream_index = index;
+	// Clear the completion and error flags of the last transfer
+	ADC->DMASTAT = 0;
+	return am_hal_adc_configure_dma(adc->handle, &dma_config) ==
+		AM_HAL_STATUS_SUCCESS;
+}
+
+// Enables the interrupts needed by whatever the ADC is doing, and no others,
+// so the processor sleeps as long as it can
+static void adc_update_interrupts(struct adc *adc)
+{
+	static const uint32_t all = AM_HAL_ADC_INT_DERR | AM_HAL_ADC_INT_DCMP |
+		AM_HAL_ADC_INT_WCINC | AM_HAL_ADC_INT_WCEXC | AM_HAL_ADC_INT_FIFOOVR2 |
+		AM_HAL_ADC_INT_FIFOOVR1 | AM_HAL_ADC_INT_SCNCMP | AM_HAL_ADC_INT_CNVCMP;
+
+	uint32_t enabled = AM_HAL_ADC_INT_FIFOOVR2 | AM_HAL_ADC_INT_FIFOOVR1 |
+		adc->window_interrupts;
+	// Streaming only wakes up once per buffer, and window monitoring only
+	// when the window is crossed, otherwise wake up with every sample
+	if (adc->streaming)
+		enabled |= AM_HAL_ADC_INT_DCMP | AM_HAL_ADC_INT_DERR;
+	else if (!adc->window_interrupts)
+		enabled |= AM_HAL_ADC_INT_SCNCMP | AM_HAL_ADC_INT_CNVCMP;
+
+	am_hal_adc_interrupt_disable(adc->handle, all & ~enabled);
+	am_hal_adc_interrupt_enable(adc->handle, enabled);
+}
+
+// Reports crossings of the window, then waits for the opposite crossing, as
+// the comparator keeps flagging samples while they stay on one side
+static void adc_window_handle(struct adc *adc, uint32_t status)
+{
+	status &= adc->window_interrupts;
+	if (status & AM_HAL_ADC_INT_WCEXC)
+	{
+		adc->window_interrupts = AM_HAL_ADC_INT_WCINC;
+		adc_update_interrupts(adc);
+		if (adc->window_outside)
+			adc->window_outside(adc->window_context);
+	}
+	else if (status & AM_HAL_ADC_INT_WCINC)
+	{
+		adc->window_interrupts = AM_HAL_ADC_INT_WCEXC;
+		adc_update_interrupts(adc);
+		if (adc->window_inside)
+			adc->window_inside(adc->window_context);
+	}
+}
+
+static void adc_stream_handle(struct adc *adc, uint32_t status)
+{
+	if (status & AM_HAL_ADC_INT_FIFOOVR2)
+		adc->stream_stats.fifo_overflows += 1;
+
+	if (status & AM_HAL_ADC_INT_DERR)
+	{
+		// Start over on the same buffer, what was in it is lost
+		adc->stream_stats.dma_errors += 1;
+		adc_stream_arm(adc, adc->stream_index);
+	}
+	else if (status & AM_HAL_ADC_INT_DCMP)
+	{
+		// Switch buffers first, the FIFO holds new samples meanwhile
+		const unsigned full = adc->stream_index;
+		adc_stream_arm(adc, !full);
+		adc->stream_stats.buffers += 1;
+		adc->stream_callback(
+			adc->stream_context, adc->stream_buffers[full], adc->stream_count
+		);
+	}
+}
+
 // This is a weak symbol for the ADC ISR
 void am_adc_isr(void)
 {
@@ -55,48 +250,95 @@ void am_adc_isr(void)
 	// Clear timer 3 interrupt.
 	am_hal_adc_interrupt_status(handle, &status, true);
 	am_hal_adc_interrupt_clear(handle, status);
+
+	if (adc_.streaming)
+		adc_stream_handle(&adc_, status);
+	if (adc_.window_interrupts)
+		adc_window_handle(&adc_, status);
 }
 
-/** Timer3 is the only one that can work with the ADC. Configure it:
- *
- * - Don't link both counters from timer A and B to form a 32-bit counter
- * - Setup to do PWM output, and use the low-freq clock / 32 as the clock source
- * - Don't setup timerA
- */
-static const am_hal_ctimer_config_t timer3_config = {
-	.ui32Link = 0,
-	.ui32TimerAConfig = (AM_HAL_CTIMER_FN_PWM_REPEAT | AM_HAL_CTIMER_LFRC_32HZ),
-	.ui32TimerBConfig = 0,
-};
+// Only CTIMER 3 can trigger the ADC
+#define ADC_TIMER 3
+
+// Largest period of a 16 bit timer segment, and the smallest period that
+// leaves room for a 50% duty cycle
+#define ADC_TIMER_MAX_PERIOD 0xFFFF
+#define ADC_TIMER_MIN_PERIOD 2
+
+#define ADC_NO_CLOCK_START (-1)
 
-// FIXME this has a bunch of hard-coded parameters
-static void adc_timer_init(void)
+struct adc_timer_clock
 {
-	// Only CTIMER 3 supports the ADC.
-	static const unsigned TIMERNUM = 3;
+	uint32_t source;
+	uint64_t millihertz;
+	int start; // clkgen request starting the clock, or ADC_NO_CLOCK_START
+};
+
+// Clock sources timer 3 can count, in order of preference when they reach a
+// rate equally well: the crystal is accurate, the LFRC is not but still low
+// power, and the HFRC is the only one fast enough for high rates
+static const struct adc_timer_clock adc_timer_clocks[] = {
+	{AM_HAL_CTIMER_XT_256HZ, 256000, AM_HAL_CLKGEN_CONTROL_XTAL_START},
+	{AM_HAL_CTIMER_XT_2_048KHZ, 2048000, AM_HAL_CLKGEN_CONTROL_XTAL_START},
+	{AM_HAL_CTIMER_XT_16_384KHZ, 16384000, AM_HAL_CLKGEN_CONTROL_XTAL_START},
+	{AM_HAL_CTIMER_XT_32_768KHZ, 32768000, AM_HAL_CLKGEN_CONTROL_XTAL_START},
+	{AM_HAL_CTIMER_LFRC_32HZ, 32000, AM_HAL_CLKGEN_CONTROL_LFRC_START},
+	{AM_HAL_CTIMER_LFRC_512HZ, 512000, AM_HAL_CLKGEN_CONTROL_LFRC_START},
+	{AM_HAL_CTIMER_HFRC_12KHZ, 11718750, ADC_NO_CLOCK_START},
+	{AM_HAL_CTIMER_HFRC_47KHZ, 46875000, ADC_NO_CLOCK_START},
+	{AM_HAL_CTIMER_HFRC_187_5KHZ, 187500000, ADC_NO_CLOCK_START},
+	{AM_HAL_CTIMER_HFRC_3MHZ, 3000000000, ADC_NO_CLOCK_START},
+	{AM_HAL_CTIMER_HFRC_12MHZ, 12000000000, ADC_NO_CLOCK_START},
+};
 
-	// Turn on the low-freq RC clock (1024Hz)
-	am_hal_clkgen_control(AM_HAL_CLKGEN_CONTROL_LFRC_START, 0);
+// Rate used until adc_set_sample_rate is called, 32 Hz LFRC / 4 = 8 Hz
+#define ADC_DEFAULT_TIMER_CLOCK (&adc_timer_clocks[4])
+#define ADC_DEFAULT_TIMER_PERIOD 4
 
-	// Set up timer 3A so start by clearing it.
-	am_hal_ctimer_clear(TIMERNUM, AM_HAL_CTIMER_TIMERA);
+/** Programs timer 3 with the clock and period chosen for the ADC and starts
+ * it:
+ *
+ * - Don't link both counters from timer A and B to form a 32-bit counter
+ * - Setup timer A to do PWM output, 50% duty cycle
+ * - Don't setup timer B
+ */
+static void adc_timer_start(const struct adc *adc)
+{
+	if (adc->timer_clock->start != ADC_NO_CLOCK_START)
+		am_hal_clkgen_control(adc->timer_clock->start, 0);
 
-	// Configure the timer to count 32Hz LFRC clocks but don't start it yet.
-	am_hal_ctimer_config(TIMERNUM, (am_hal_ctimer_config_t *)&timer3_config);
+	am_hal_ctimer_stop(ADC_TIMER, AM_HAL_CTIMER_TIMERA);
+	am_hal_ctimer_clear(ADC_TIMER, AM_HAL_CTIMER_TIMERA);
 
-	// Compute CMPR value needed for desired period based on a 32HZ clock.
-	// 32 ticks per sec * 1/8 second = 4 ticks period
-	// PWM 50% duty cycle
-	uint32_t period = 32 / 8;
+	am_hal_ctimer_config_t timer3_config = {
+		.ui32Link = 0,
+		.ui32TimerAConfig =
+			AM_HAL_CTIMER_FN_PWM_REPEAT | adc->timer_clock->source,
+		.ui32TimerBConfig = 0,
+	};
+	am_hal_ctimer_config(ADC_TIMER, &timer3_config);
 	am_hal_ctimer_period_set(
-		TIMERNUM, AM_HAL_CTIMER_TIMERA, period, (period >> 1)
+		ADC_TIMER,
+		AM_HAL_CTIMER_TIMERA,
+		adc->timer_period,
+		adc->timer_period >> 1
 	);
 
 	// Set up timer 3A as the trigger source for the ADC.
 	am_hal_ctimer_adc_trigger_enable();
+	am_hal_ctimer_start(ADC_TIMER, AM_HAL_CTIMER_TIMERA);
+}
+
+static void adc_timer_stop(void)
+{
+	am_hal_ctimer_stop(ADC_TIMER, AM_HAL_CTIMER_TIMERA);
+	am_hal_ctimer_adc_trigger_disable();
+}
 
-	// Start timer 3A.
-	am_hal_ctimer_start(TIMERNUM, AM_HAL_CTIMER_TIMERA);
+static uint64_t adc_timer_millihertz(const struct adc *adc)
+{
+	return (adc->timer_clock->millihertz + adc->timer_period / 2) /
+		adc->timer_period;
 }
 
 // * *****************************************************************************
@@ -152,6 +394,23 @@ const int ADC_CHANNEL_MAX =
 // *
 // * *****************************************************************************
 
+static void adc_init_pin(uint32_t pin, uint32_t funcsel)
+{
+	if (pin == NO_PIN)
+		return;
+
+	const am_hal_gpio_pincfg_t cfg = {.uFuncSel = funcsel};
+	uint32_t status = am_hal_gpio_pinconfig(pin, cfg);
+	if (status != AM_HAL_STATUS_SUCCESS)
+	{
+		am_util_stdio_printf(
+			"Error - Couldnt configure pin %d, status=0x%x\r\n", pin, status
+		);
+		while (1)
+			;
+	}
+}
+
 static void adc_init_channels(
 	struct adc *adc, const am_hal_adc_slot_chan_e *channels, uint8_t size
 )
@@ -168,40 +427,21 @@ static void adc_init_channels(
 	// Configure the pins given
 	for (size_t i = 0; i < size; i++)
 	{
-		channel_settings_t settings = g_channel_settings[channels[i]];
-
-		// If 2 pins specified, it's a differential channel
-		if (settings.pin_p != NO_PIN && settings.pin_n != NO_PIN)
+		if ((unsigned)channels[i] >= ADC_CHANNELS)
 		{
 			am_util_stdio_printf(
-				"Error - ADC Differential channels not yet implemented, "
-				"panicking\r\n"
+				"Error - Invalid ADC channel %d\r\n", channels[i]
 			);
 			while (1)
 				;
-
-			// If 1 pin specified, it's a normal single-ended channel, set it's
-			// funcsel appropriately
-		}
-		else if (settings.pin_p != NO_PIN)
-		{
-			const am_hal_gpio_pincfg_t cfg = {
-				.uFuncSel = settings.gpio_funcsel_p
-			};
-
-			uint32_t status = am_hal_gpio_pinconfig(settings.pin_p, cfg);
-			if (status != AM_HAL_STATUS_SUCCESS)
-			{
-				am_util_stdio_printf(
-					"Error - Couldnt configure pin %d, status=0x%x\r\n",
-					settings.pin_p, status
-				);
-				while (1)
-					;
-			}
 		}
+		channel_settings_t settings = g_channel_settings[channels[i]];
 
-		// Else, misc ADC channels take no pins (bat VSS temp)
+		// Single-ended channels have one pin, differential channels have a
+		// negative one too, set their funcsel appropriately. Misc ADC
+		// channels take no pins (bat VSS temp)
+		adc_init_pin(settings.pin_p, settings.gpio_funcsel_p);
+		adc_init_pin(settings.pin_n, settings.gpio_funcsel_n);
 	}
 
 	// Initialize the ADC and get the handle.
@@ -212,6 +452,8 @@ static void adc_init_channels(
 		return;
 	}
 	interrupt_adc_handle = adc->handle;
+	adc->timer_clock = ADC_DEFAULT_TIMER_CLOCK;
+	adc->timer_period = ADC_DEFAULT_TIMER_PERIOD;
 
 	// Power on the ADC.
 	// Don't save power state (actually can't-- state is saved when switching
@@ -226,8 +468,8 @@ static void adc_init_channels(
 	}
 
 	// Configure the ADC.
-	result =
-		am_hal_adc_configure(adc->handle, (am_hal_adc_config_t *)&adc_config);
+	adc->config = adc_config;
+	result = am_hal_adc_configure(adc->handle, &adc->config);
 	if (result != AM_HAL_STATUS_SUCCESS)
 	{
 		am_util_stdio_printf("Error - configuring ADC failed.\r\n");
@@ -253,22 +495,17 @@ static void adc_init_channels(
 	am_hal_adc_configure_slot(adc->handle, 6, &slot_config);
 	am_hal_adc_configure_slot(adc->handle, 7, &slot_config);
 
-	// Configure enabled slots shared settings
-	slot_config.bEnabled = true;
-	slot_config.bWindowCompare = true;
-	// Already configured eMeasToAvg = AM_HAL_ADC_SLOT_AVG_1
-
-	// Configure the input slot
-	slot_config.ePrecisionMode = AM_HAL_ADC_SLOT_14BIT;
-
-	// Configure the slots with the given channels
+	// Configure the slots with the given channels, 14 bits and no averaging
+	memset(adc->channel_slots, ADC_NO_SLOT, sizeof(adc->channel_slots));
 	for (size_t i = 0; i < size; i++)
 	{
-		slot_config.eChannel = channels[i];
-		am_hal_adc_configure_slot(adc->handle, i, &slot_config);
-
-		// also save which channels went to which slots
+		// also save which channels went to which slots, both ways
 		adc->slot_channels[i] = channels[i];
+		adc->channel_slots[channels[i]] = i;
+		adc->slot_settings[i] = adc_default_slot;
+
+		slot_config = adc_slot_hal_config(adc, i);
+		am_hal_adc_configure_slot(adc->handle, i, &slot_config);
 
 		am_util_stdio_printf(
 			"Configure slot %d to channel %d\n", i, channels[i]
@@ -280,23 +517,19 @@ static void adc_init_channels(
 	NVIC_EnableIRQ(ADC_IRQn);
 
 	// Enable the ADC interrupts in the ADC.
-	am_hal_adc_interrupt_enable(
-		adc->handle, AM_HAL_ADC_INT_WCINC | AM_HAL_ADC_INT_WCEXC |
-						 AM_HAL_ADC_INT_FIFOOVR2 | AM_HAL_ADC_INT_FIFOOVR1 |
-						 AM_HAL_ADC_INT_SCNCMP | AM_HAL_ADC_INT_CNVCMP
-	);
+	adc_update_interrupts(adc);
 }
 
-// Converts a pin number to a single-ended ADC channel, if possible
-am_hal_adc_slot_chan_e adc_channel_for_pin(uint8_t pin)
-{
+// Single-ended ADC channel of every pin, or ADC_NO_CHANNEL
+static uint8_t adc_pin_channels[AM_HAL_GPIO_MAX_PADS];
 
-	// Loop over single-ended channels, see if any match
-	for (size_t i = AM_HAL_ADC_SLOT_CHSEL_SE0; i <= AM_HAL_ADC_SLOT_CHSEL_SE9;
-		 i++)
+static void adc_build_pin_map(void)
+{
+	memset(adc_pin_channels, ADC_NO_CHANNEL, sizeof(adc_pin_channels));
+	for (size_t i = 0; i < (size_t)ADC_CHANNEL_MAX; i++)
 	{
-
-		// sanity check assert: all channels should be in their own index
+		// sanity check assert: all channels should be in their own index, as
+		// the table is indexed by channel everywhere
 		if (g_channel_settings[i].channel != i)
 		{
 			am_util_stdio_printf(
@@ -307,11 +540,19 @@ am_hal_adc_slot_chan_e adc_channel_for_pin(uint8_t pin)
 				;
 		}
 
-		if (g_channel_settings[i].pin_p == pin)
+		if (i <= AM_HAL_ADC_SLOT_CHSEL_SE9 &&
+			g_channel_settings[i].pin_p < AM_HAL_GPIO_MAX_PADS)
 		{
-			return (am_hal_adc_slot_chan_e)i;
+			adc_pin_channels[g_channel_settings[i].pin_p] = i;
 		}
 	}
+}
+
+// Converts a pin number to a single-ended ADC channel, if possible
+am_hal_adc_slot_chan_e adc_channel_for_pin(uint8_t pin)
+{
+	if (pin < AM_HAL_GPIO_MAX_PADS && adc_pin_channels[pin] != ADC_NO_CHANNEL)
+		return (am_hal_adc_slot_chan_e)adc_pin_channels[pin];
 
 	// This pin matches no channel
 	am_util_stdio_printf(
@@ -321,10 +562,39 @@ am_hal_adc_slot_chan_e adc_channel_for_pin(uint8_t pin)
 		;
 }
 
+// Configures or disables the pins of the configured slots
+static void adc_pins_config(const struct adc *adc, bool enable)
+{
+	for (uint8_t i = 0; i < adc->slots_configured; ++i)
+	{
+		const channel_settings_t *settings =
+			&g_channel_settings[adc->slot_channels[i]];
+		if (settings->pin_p != NO_PIN)
+		{
+			const am_hal_gpio_pincfg_t cfg = {
+				.uFuncSel = settings->gpio_funcsel_p
+			};
+			am_hal_gpio_pinconfig(
+				settings->pin_p, enable ? cfg : g_AM_HAL_GPIO_DISABLE
+			);
+		}
+		if (settings->pin_n != NO_PIN)
+		{
+			const am_hal_gpio_pincfg_t cfg = {
+				.uFuncSel = settings->gpio_funcsel_n
+			};
+			am_hal_gpio_pinconfig(
+				settings->pin_n, enable ? cfg : g_AM_HAL_GPIO_DISABLE
+			);
+		}
+	}
+}
+
 struct adc *adc_get_instance(const uint8_t *pins, uint8_t size)
 {
 	if (!adc_.handle)
 	{
+		adc_build_pin_map();
 		if (size > 8)
 		{
 			am_util_stdio_printf(
@@ -348,38 +618,31 @@ struct adc *adc_get_instance(const uint8_t *pins, uint8_t size)
 	return &adc_;
 }
 
+struct adc *adc_get_instance_channels(
+	const am_hal_adc_slot_chan_e channels[], uint8_t size
+)
+{
+	if (!adc_.handle)
+	{
+		adc_build_pin_map();
+		adc_init_channels(&adc_, channels, size);
+		adc_sleep(&adc_);
+	}
+	adc_.refcount++;
+	return &adc_;
+}
+
 void adc_deinitialize(struct adc *adc)
 {
 	if (adc->refcount)
 	{
 		if (!--(adc->refcount))
 		{
+			adc_stream_stop(adc);
+			if (adc->timed)
+				adc_timer_stop();
 			NVIC_DisableIRQ(ADC_IRQn);
-			// We need to find what pins are configured and disable them.
-			for (uint8_t i = 0; i < adc->slots_configured; ++i)
-			{
-				for (uint8_t j = 0; j < ADC_CHANNEL_MAX; ++j)
-				{
-					if (adc->slot_channels[i] == g_channel_settings[j].channel)
-					{
-						if (g_channel_settings[j].pin_p != NO_PIN)
-						{
-							am_hal_gpio_pinconfig(
-								g_channel_settings[j].pin_p,
-								g_AM_HAL_GPIO_DISABLE
-							);
-						}
-						if (g_channel_settings[j].pin_n != NO_PIN)
-						{
-							am_hal_gpio_pinconfig(
-								g_channel_settings[j].pin_n,
-								g_AM_HAL_GPIO_DISABLE
-							);
-						}
-						break;
-					}
-				}
-			}
+			adc_pins_config(adc, false);
 
 			am_hal_adc_power_control(
 				adc->handle, AM_HAL_SYSCTRL_DEEPSLEEP, false
@@ -392,6 +655,10 @@ void adc_deinitialize(struct adc *adc)
 
 bool adc_sleep(struct adc *adc)
 {
+	adc_stream_stop(adc);
+	// Timed sampling resumes on adc_enable
+	if (adc->timed)
+		adc_timer_stop();
 	NVIC_DisableIRQ(ADC_IRQn);
 
 	// Note that turning off the hardware resets registers, which is why we
@@ -407,29 +674,7 @@ bool adc_sleep(struct adc *adc)
 	}
 	while (status == AM_HAL_STATUS_IN_USE);
 
-	// We need to find what pins are configured and disable them.
-	for (uint8_t i = 0; i < adc->slots_configured; ++i)
-	{
-		for (uint8_t j = 0; j < ADC_CHANNEL_MAX; ++j)
-		{
-			if (adc->slot_channels[i] == g_channel_settings[j].channel)
-			{
-				if (g_channel_settings[j].pin_p != NO_PIN)
-				{
-					am_hal_gpio_pinconfig(
-						g_channel_settings[j].pin_p, g_AM_HAL_GPIO_DISABLE
-					);
-				}
-				if (g_channel_settings[j].pin_n != NO_PIN)
-				{
-					am_hal_gpio_pinconfig(
-						g_channel_settings[j].pin_n, g_AM_HAL_GPIO_DISABLE
-					);
-				}
-				break;
-			}
-		}
-	}
+	adc_pins_config(adc, false);
 	return true;
 }
 
@@ -444,81 +689,83 @@ bool adc_enable(struct adc *adc)
 		return false;
 	}
 
-	// We need to find what pins are configured and turn them on.
-	for (uint8_t i = 0; i < adc->slots_configured; ++i)
-	{
-		for (uint8_t j = 0; j < ADC_CHANNEL_MAX; ++j)
-		{
-			if (adc->slot_channels[i] == g_channel_settings[j].channel)
-			{
-				if (g_channel_settings[j].pin_p != NO_PIN)
-				{
-					const am_hal_gpio_pincfg_t cfg = {
-						.uFuncSel = g_channel_settings[j].gpio_funcsel_p
-					};
-					am_hal_gpio_pinconfig(g_channel_settings[j].pin_p, cfg);
-				}
-				if (g_channel_settings[j].pin_n != NO_PIN)
-				{
-					const am_hal_gpio_pincfg_t cfg = {
-						.uFuncSel = g_channel_settings[j].gpio_funcsel_n
-					};
-					am_hal_gpio_pinconfig(g_channel_settings[j].pin_n, cfg);
-				}
-				break;
-			}
-		}
-	}
+	adc_pins_config(adc, true);
 
 	NVIC_EnableIRQ(ADC_IRQn);
+	if (adc->timed)
+	{
+		adc_timer_start(adc);
+		am_hal_adc_sw_trigger(adc->handle);
+	}
 	return true;
 }
 
-// Helper function: converts pins to channels and calls adc_get_sample_channels
-bool adc_get_sample(
-	struct adc *adc, uint32_t out_samples[], const uint8_t pins[], size_t size
+bool adc_prepare_request(
+	const struct adc *adc,
+	struct adc_request *request,
+	const am_hal_adc_slot_chan_e channels[],
+	size_t size
 )
 {
-	if (size > 8)
+	if (size > ADC_MAX_SLOTS)
+		return false;
+
+	memset(request->outputs, ADC_NO_OUTPUT, sizeof(request->outputs));
+	for (size_t i = 0; i < size; ++i)
 	{
-		am_util_stdio_printf("Error - ADC can't take more than 8 slots\r\n");
-		while (1)
-			;
+		if ((unsigned)channels[i] >= ADC_CHANNELS)
+			return false;
+		// Channels without a slot are never written, and only the first
+		// request for a channel is
+		const uint8_t slot = adc->channel_slots[channels[i]];
+		if (slot != ADC_NO_SLOT && request->outputs[slot] == ADC_NO_OUTPUT)
+			request->outputs[slot] = i;
 	}
+	return true;
+}
+
+bool adc_prepare_request_pins(
+	const struct adc *adc,
+	struct adc_request *request,
+	const uint8_t pins[],
+	size_t size
+)
+{
+	if (size > ADC_MAX_SLOTS)
+		return false;
 
-	// Convert pins to channels, then call the main function
-	am_hal_adc_slot_chan_e channels[8] = {};
+	am_hal_adc_slot_chan_e channels[ADC_MAX_SLOTS];
 	for (size_t i = 0; i < size; i++)
 	{
 		channels[i] = adc_channel_for_pin(pins[i]);
 	}
-
-	return adc_get_sample_channels(adc, out_samples, channels, size);
+	return adc_prepare_request(adc, request, channels, size);
 }
 
-bool adc_get_sample_channels(
-	struct adc *adc, uint32_t out_samples[],
-	const am_hal_adc_slot_chan_e req_channels[], size_t size
+bool adc_get_sample_request(
+	struct adc *adc, uint32_t out_samples[], const struct adc_request *request
 )
 {
 	if (AM_HAL_ADC_FIFO_COUNT(ADC->FIFO) < adc->slots_configured)
 		return false;
 
-	for (size_t i = 0; i < size; i++)
+	// Read a whole scan at once
+	// in/out, is # samples requested and # received
+	uint32_t num_samples = adc->slots_configured;
+	am_hal_adc_sample_t data[ADC_MAX_SLOTS];
+	am_hal_adc_samples_read(adc->handle, true, NULL, &num_samples, data);
+
+	// Some asserts for sanity checking
+	if (num_samples != adc->slots_configured)
 	{
-		uint32_t num_samples =
-			1; // in/out, is # samples requested and # received
-		am_hal_adc_sample_t data = {0};
-		am_hal_adc_samples_read(adc->handle, true, NULL, &num_samples, &data);
+		am_util_stdio_printf("Error: adc returned no samples??\n");
+		while (1)
+			;
+	}
 
-		// Some asserts for sanity checking
-		if (num_samples != 1)
-		{
-			am_util_stdio_printf("Error: adc returned no samples??\n");
-			while (1)
-				;
-		}
-		if (data.ui32Slot >= adc->slots_configured)
+	for (size_t i = 0; i < num_samples; i++)
+	{
+		if (data[i].ui32Slot >= adc->slots_configured)
 		{
 			am_util_stdio_printf(
 				"Error: adc returned sample for invalid slot?\n"
@@ -527,24 +774,361 @@ bool adc_get_sample_channels(
 				;
 		}
 
-		// Lookup what channel we had configured for the slot the sample is for
-		uint32_t data_channel = adc->slot_channels[data.ui32Slot];
+		const uint8_t slot = data[i].ui32Slot;
+		const uint8_t output = request->outputs[slot];
+		if (output == ADC_NO_OUTPUT)
+			continue;
 
-		// check which index user requested this channel at (if any)
-		for (size_t j = 0; j < size; ++j)
+		uint32_t sample = AM_HAL_ADC_FIFO_SAMPLE(data[i].ui32Sample);
+		if (g_channel_settings[adc->slot_channels[slot]].pin_n != NO_PIN)
 		{
-			if (req_channels[j] == data_channel)
-			{
-				out_samples[j] = AM_HAL_ADC_FIFO_SAMPLE(data.ui32Sample);
-				break;
-			}
+			sample = (uint32_t)adc_convert_signed(
+				sample, adc->slot_settings[slot].precision
+			);
 		}
+		out_samples[output] = sample;
 	}
 	return true;
 }
 
+// Helper function: converts pins to channels and calls adc_get_sample_request
+bool adc_get_sample(
+	struct adc *adc, uint32_t out_samples[], const uint8_t pins[], size_t size
+)
+{
+	struct adc_request request;
+	if (!adc_prepare_request_pins(adc, &request, pins, size))
+	{
+		am_util_stdio_printf("Error - ADC can't take more than 8 slots\r\n");
+		while (1)
+			;
+	}
+	return adc_get_sample_request(adc, out_samples, &request);
+}
+
+bool adc_get_sample_channels(
+	struct adc *adc, uint32_t out_samples[],
+	const am_hal_adc_slot_chan_e req_channels[], size_t size
+)
+{
+	struct adc_request request;
+	if (!adc_prepare_request(adc, &request, req_channels, size))
+		return false;
+	return adc_get_sample_request(adc, out_samples, &request);
+}
+
 void adc_trigger(struct adc *adc)
 {
 	// Kick Start Timer 3 with an ADC software trigger in REPEAT used.
 	am_hal_adc_sw_trigger(adc->handle);
 }
+
+// Applies the configuration and slot settings, which only take effect while
+// the ADC is disabled
+static bool adc_reconfigure(struct adc *adc)
+{
+	am_hal_adc_disable(adc->handle);
+	uint32_t result = am_hal_adc_configure(adc->handle, &adc->config);
+	for (uint8_t i = 0; i < adc->slots_configured; ++i)
+	{
+		am_hal_adc_slot_config_t slot_config = adc_slot_hal_config(adc, i);
+		if (result == AM_HAL_STATUS_SUCCESS)
+		{
+			result =
+				am_hal_adc_configure_slot(adc->handle, i, &slot_config);
+		}
+	}
+	am_hal_adc_enable(adc->handle);
+
+	// Repeating scans stop when the ADC is disabled, restart them
+	if (adc->timed)
+		am_hal_adc_sw_trigger(adc->handle);
+	return result == AM_HAL_STATUS_SUCCESS;
+}
+
+// Switches between software triggered single scans and repeating scans
+// triggered by timer 3
+static bool adc_set_repeat(struct adc *adc, bool repeat)
+{
+	const am_hal_adc_repeat_e previous = adc->config.eRepeat;
+	adc->config.eRepeat =
+		repeat ? AM_HAL_ADC_REPEATING_SCAN : AM_HAL_ADC_SINGLE_SCAN;
+	if (!adc_reconfigure(adc))
+	{
+		adc->config.eRepeat = previous;
+		adc_reconfigure(adc);
+		return false;
+	}
+	return true;
+}
+
+bool adc_set_slot_config(
+	struct adc *adc, uint8_t slot, const struct adc_slot_config *config
+)
+{
+	am_hal_adc_slot_prec_e precision;
+	am_hal_adc_meas_avg_e averaging;
+	if (slot >= adc->slots_configured ||
+		!adc_precision_mode(config->precision, &precision) ||
+		!adc_averaging_mode(config->averages, &averaging))
+	{
+		return false;
+	}
+
+	const struct adc_slot_config previous = adc->slot_settings[slot];
+	adc->slot_settings[slot] = *config;
+	if (!adc_reconfigure(adc))
+	{
+		adc->slot_settings[slot] = previous;
+		adc_reconfigure(adc);
+		return false;
+	}
+	return true;
+}
+
+bool adc_get_slot_config(
+	const struct adc *adc, uint8_t slot, struct adc_slot_config *config
+)
+{
+	if (slot >= adc->slots_configured)
+		return false;
+	*config = adc->slot_settings[slot];
+	return true;
+}
+
+bool adc_set_power_mode(struct adc *adc, enum adc_power_mode mode)
+{
+	if ((size_t)mode >= sizeof(adc_power_modes) / sizeof(*adc_power_modes))
+		return false;
+
+	const am_hal_adc_config_t previous = adc->config;
+	adc->config.eClockMode = adc_power_modes[mode].clock_mode;
+	adc->config.ePowerMode = adc_power_modes[mode].power_mode;
+	if (!adc_reconfigure(adc))
+	{
+		adc->config = previous;
+		adc_reconfigure(adc);
+		return false;
+	}
+	return true;
+}
+
+// The ADC must already be set to repeat
+static void adc_timed_begin(struct adc *adc)
+{
+	adc_timer_start(adc);
+	// After the first software trigger, timer 3 triggers every other scan
+	am_hal_adc_sw_trigger(adc->handle);
+	adc->timed = true;
+}
+
+static void adc_timed_end(struct adc *adc)
+{
+	adc_timer_stop();
+	adc->timed = false;
+	adc_set_repeat(adc, false);
+
+	// Don't leave timed samples behind for adc_get_sample
+	while (AM_HAL_ADC_FIFO_COUNT(ADC->FIFO))
+	{
+		uint32_t num_samples = 1;
+		am_hal_adc_sample_t data;
+		am_hal_adc_samples_read(adc->handle, true, NULL, &num_samples, &data);
+	}
+}
+
+uint32_t adc_set_sample_rate(struct adc *adc, uint32_t hz)
+{
+	if (!hz)
+	{
+		adc_stream_stop(adc);
+		if (adc->timed)
+			adc_timed_end(adc);
+		return 0;
+	}
+	if (hz > ADC_MAX_SAMPLE_RATE)
+		return 0;
+
+	const uint64_t target = (uint64_t)hz * 1000;
+	const struct adc_timer_clock *best_clock = NULL;
+	uint32_t best_period = 0;
+	uint64_t best_error = UINT64_MAX;
+	for (size_t i = 0; i < sizeof(adc_timer_clocks) / sizeof(*adc_timer_clocks);
+		 ++i)
+	{
+		const struct adc_timer_clock *clock = &adc_timer_clocks[i];
+		const uint64_t period = (clock->millihertz + target / 2) / target;
+		if (period < ADC_TIMER_MIN_PERIOD || period > ADC_TIMER_MAX_PERIOD)
+			continue;
+		const uint64_t achieved = (clock->millihertz + period / 2) / period;
+		const uint64_t error =
+			achieved > target ? achieved - target : target - achieved;
+		if (error < best_error)
+		{
+			best_clock = clock;
+			best_period = period;
+			best_error = error;
+		}
+	}
+	if (!best_clock)
+		return 0;
+
+	adc->timer_clock = best_clock;
+	adc->timer_period = best_period;
+	if (adc->timed)
+	{
+		adc_timer_start(adc);
+	}
+	else
+	{
+		if (!adc_set_repeat(adc, true))
+			return 0;
+		adc_timed_begin(adc);
+	}
+	// Asked for explicitly, so it outlives any stream
+	adc->stream_timed = false;
+	return adc_timer_millihertz(adc);
+}
+
+uint32_t adc_get_sample_rate(const struct adc *adc)
+{
+	return adc_timer_millihertz(adc);
+}
+
+bool adc_stream_start(
+	struct adc *adc,
+	uint32_t *buffer0,
+	uint32_t *buffer1,
+	size_t count,
+	adc_stream_callback callback,
+	void *context
+)
+{
+	if (adc->streaming || !buffer0 || !buffer1 || !count || !callback)
+		return false;
+
+	adc->stream_buffers[0] = buffer0;
+	adc->stream_buffers[1] = buffer1;
+	adc->stream_count = count;
+	adc->stream_callback = callback;
+	adc->stream_context = context;
+	memset(&adc->stream_stats, 0, sizeof(adc->stream_stats));
+
+	const bool was_timed = adc->timed;
+	if (!was_timed && !adc_set_repeat(adc, true))
+		return false;
+	if (!adc_stream_arm(adc, 0))
+	{
+		if (!was_timed)
+			adc_set_repeat(adc, false);
+		return false;
+	}
+
+	// Only wake up once per buffer, not once per conversion
+	// The window ISR updates the interrupts too, so keep it out while we do
+	uint32_t state = am_hal_interrupt_master_disable();
+	am_hal_adc_interrupt_clear(
+		adc->handle, AM_HAL_ADC_INT_DCMP | AM_HAL_ADC_INT_DERR
+	);
+	adc->streaming = true;
+	adc_update_interrupts(adc);
+	am_hal_interrupt_master_set(state);
+	adc->stream_timed = !was_timed;
+
+	if (!was_timed)
+		adc_timed_begin(adc);
+	return true;
+}
+
+void adc_stream_stop(struct adc *adc)
+{
+	if (!adc->streaming)
+		return;
+
+	uint32_t state = am_hal_interrupt_master_disable();
+	adc->streaming = false;
+	am_hal_adc_interrupt_clear(
+		adc->handle, AM_HAL_ADC_INT_SCNCMP | AM_HAL_ADC_INT_CNVCMP
+	);
+	adc_update_interrupts(adc);
+	am_hal_interrupt_master_set(state);
+
+	const am_hal_adc_dma_config_t dma_config = {
+		.bDMAEnable = false,
+	};
+	am_hal_adc_configure_dma(
+		adc->handle, (am_hal_adc_dma_config_t *)&dma_config
+	);
+	if (adc->stream_timed)
+		adc_timed_end(adc);
+}
+
+void adc_stream_get_stats(
+	const struct adc *adc, struct adc_stream_stats *stats
+)
+{
+	uint32_t state = am_hal_interrupt_master_disable();
+	*stats = adc->stream_stats;
+	am_hal_interrupt_master_set(state);
+}
+
+bool adc_set_window(struct adc *adc, uint32_t lower, uint32_t upper)
+{
+	if (lower > upper || upper > ADC_WINDOW_MAX)
+		return false;
+
+	// The limits compare against FIFO values, which have 6 fractional bits.
+	// Let averaged samples up to upper + 63/64 in, and scale the limits down
+	// for slots with less than 14 bits.
+	am_hal_adc_window_config_t window_config = {
+		.bScaleLimits = true,
+		.ui32Upper = upper << 6 | 0x3F,
+		.ui32Lower = lower << 6,
+	};
+	return am_hal_adc_control(
+		adc->handle, AM_HAL_ADC_REQ_WINDOW_CONFIG, &window_config
+	) == AM_HAL_STATUS_SUCCESS;
+}
+
+void adc_set_window_callbacks(
+	struct adc *adc,
+	adc_window_callback inside,
+	adc_window_callback outside,
+	void *context
+)
+{
+	uint32_t state = am_hal_interrupt_master_disable();
+	adc->window_inside = inside;
+	adc->window_outside = outside;
+	adc->window_context = context;
+	// Which side samples are on is unknown, so wait for either event first
+	adc->window_interrupts = inside || outside ?
+		AM_HAL_ADC_INT_WCINC | AM_HAL_ADC_INT_WCEXC : 0;
+	am_hal_adc_interrupt_clear(
+		adc->handle, AM_HAL_ADC_INT_WCINC | AM_HAL_ADC_INT_WCEXC
+	);
+	adc_update_interrupts(adc);
+	am_hal_interrupt_master_set(state);
+}
+
+bool adc_get_temperature_trims(
+	struct adc *adc, struct adc_convert_temperature_trims *trims
+)
+{
+	// Calibration temperature, voltage, offset, and whether the device was
+	// calibrated, all as floats
+	float values[4] = {0};
+	if (am_hal_adc_control(
+			adc->handle, AM_HAL_ADC_REQ_TEMP_TRIMS_GET, values
+		) != AM_HAL_STATUS_SUCCESS ||
+		values[3] == 0.0f)
+	{
+		*trims = ADC_CONVERT_TEMPERATURE_TRIMS_DEFAULT;
+		return false;
+	}
+
+	trims->calibration_kelvin = values[0];
+	trims->calibration_volts = values[1];
+	trims->offset_volts = values[2];
+	return true;
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <adc_convert.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FIFO words hold the sample in bits 0 to 19, with 6 fractional bits
+#define ADC_CONVERT_FIFO_DATA_MASK 0xFFFFFu
+#define ADC_CONVERT_FIFO_FRACTION_BITS 6
+
+// Everything here is integer or single precision maths, as the Cortex-M4F
+// has no double precision FPU
+
+static uint32_t adc_convert_max(uint8_t precision)
+{
+	return (UINT32_C(1) << precision) - 1;
+}
+
+uint32_t adc_convert_millivolts(
+	uint32_t sample, uint8_t precision, uint32_t reference_mv
+)
+{
+	const uint32_t max = adc_convert_max(precision);
+	return (sample * reference_mv + max / 2) / max;
+}
+
+void adc_convert_millivolts_bulk(
+	const uint32_t *words,
+	uint32_t *millivolts,
+	size_t count,
+	uint8_t precision,
+	uint32_t reference_mv
+)
+{
+	// Divide once, by turning the scale into a 0.32 fixed point factor,
+	// which fits as long as the reference is below the largest FIFO value
+	const uint32_t full_scale = adc_convert_max(precision)
+		<< ADC_CONVERT_FIFO_FRACTION_BITS;
+	const uint32_t scale = ((uint64_t)reference_mv << 32) / full_scale;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t data = words[i] & ADC_CONVERT_FIFO_DATA_MASK;
+		millivolts[i] =
+			((uint64_t)data * scale + (UINT64_C(1) << 31)) >> 32;
+	}
+}
+
+int32_t adc_convert_signed(uint32_t sample, uint8_t precision)
+{
+	// Move the sign bit of the sample to bit 31, and shift back arithmetically
+	const unsigned shift = 32 - precision;
+	return (int32_t)(sample << shift) >> shift;
+}
+
+int32_t adc_convert_differential_millivolts(
+	int32_t sample, uint8_t precision, uint32_t reference_mv
+)
+{
+	// Half of the range is positive, round away from zero on both sides
+	const int32_t max = adc_convert_max(precision - 1);
+	const int32_t scaled = sample * (int32_t)reference_mv;
+	const int32_t half = scaled < 0 ? -(max / 2) : max / 2;
+	return (scaled + half) / max;
+}
+
+uint32_t adc_convert_divider(
+	uint32_t millivolts, const struct adc_convert_divider *divider
+)
+{
+	return (millivolts * divider->numerator + divider->denominator / 2) /
+		divider->denominator;
+}
+
+uint32_t adc_convert_battery_millivolts(
+	uint32_t sample, uint8_t precision, uint32_t reference_mv
+)
+{
+	// Scale before dividing, so the divider doesn't multiply rounding errors
+	const struct adc_convert_divider divider = ADC_CONVERT_BATTERY_DIVIDER;
+	const uint32_t denominator =
+		adc_convert_max(precision) * divider.denominator;
+	return (sample * reference_mv * divider.numerator + denominator / 2) /
+		denominator;
+}
+
+void adc_convert_temperature_curve(
+	struct adc_convert_temperature_curve *curve,
+	const struct adc_convert_temperature_trims *trims,
+	uint8_t precision,
+	uint32_t reference_mv
+)
+{
+	// T = T_cal * (V - V_offset) / (V_cal - V_offset), in K
+	const float kelvin_per_volt = trims->calibration_kelvin /
+		(trims->calibration_volts - trims->offset_volts);
+	const float volts_per_count =
+		(float)reference_mv / 1000.0f / (float)adc_convert_max(precision);
+	curve->slope = kelvin_per_volt * volts_per_count;
+	curve->intercept = -kelvin_per_volt * trims->offset_volts - 273.15f;
+}
+
+float adc_convert_celsius(
+	const struct adc_convert_temperature_curve *curve, uint32_t sample
+)
+{
+	return (float)sample * curve->slope + curve->intercept;
+}
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <adc_pipeline.h>
+
+#include <arm_math.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// FIFO words hold the slot in bits 28 to 30, and the sample in bits 0 to 19,
+// with 6 fractional bits
+#define ADC_PIPELINE_FIFO_SLOT(word) (((word) >> 28) & 0x7)
+#define ADC_PIPELINE_FIFO_DATA(word) ((word) & 0xFFFFF)
+#define ADC_PIPELINE_FIFO_FRACTION_BITS 6
+
+static unsigned adc_pipeline_log2(uint32_t value)
+{
+	unsigned result = 0;
+	while (value >>= 1)
+		++result;
+	return result;
+}
+
+static uint32_t adc_pipeline_cic_decimation(
+	const struct adc_pipeline_config *config
+)
+{
+	return config->cic_stages ? config->cic_decimation : 1;
+}
+
+static uint32_t adc_pipeline_fir_decimation(
+	const struct adc_pipeline_config *config
+)
+{
+	return config->fir_taps ? config->fir_decimation : 1;
+}
+
+static q15_t adc_pipeline_saturate(int32_t value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+}
+
+bool adc_pipeline_init(
+	struct adc_pipeline *pipeline, const struct adc_pipeline_config *config
+)
+{
+	if (!config->channels || config->channels > ADC_PIPELINE_MAX_CHANNELS ||
+		config->precision < 8 || config->precision > 14 ||
+		!config->block_size || config->block_size > ADC_PIPELINE_MAX_BLOCK ||
+		config->dc_shift > 16 ||
+		config->cic_stages > ADC_PIPELINE_MAX_CIC_STAGES ||
+		config->fir_taps > ADC_PIPELINE_MAX_TAPS)
+	{
+		return false;
+	}
+
+	if (config->cic_stages)
+	{
+		const uint32_t decimation = config->cic_decimation;
+		if (!decimation || (decimation & (decimation - 1)) ||
+			config->cic_stages * adc_pipeline_log2(decimation) > 16)
+		{
+			return false;
+		}
+	}
+	if (config->fir_taps && (!config->fir_decimation ||
+		!config->fir_coefficients))
+	{
+		return false;
+	}
+
+	const uint32_t cic_decimation = adc_pipeline_cic_decimation(config);
+	const uint32_t decimation =
+		cic_decimation * adc_pipeline_fir_decimation(config);
+	if (config->block_size % decimation)
+		return false;
+
+	memset(pipeline, 0, sizeof(*pipeline));
+	pipeline->config = *config;
+	if (config->fir_taps)
+	{
+		for (size_t i = 0; i < config->channels; ++i)
+		{
+			struct adc_pipeline_channel *channel = &pipeline->channels[i];
+			arm_status status = arm_fir_decimate_init_q15(
+				&channel->fir,
+				config->fir_taps,
+				config->fir_decimation,
+				config->fir_coefficients,
+				channel->fir_state,
+				config->block_size / cic_decimation
+			);
+			if (status != ARM_MATH_SUCCESS)
+				return false;
+		}
+	}
+	return true;
+}
+
+size_t adc_pipeline_block_frames(const struct adc_pipeline *pipeline)
+{
+	const struct adc_pipeline_config *config = &pipeline->config;
+	return config->block_size / adc_pipeline_cic_decimation(config) /
+		adc_pipeline_fir_decimation(config);
+}
+
+// Pulls one channel out of the block, scaled to the full q15 range
+static void adc_pipeline_gather(
+	struct adc_pipeline *pipeline, const uint32_t *words, uint8_t channel
+)
+{
+	const struct adc_pipeline_config *config = &pipeline->config;
+	const int bits = config->precision + ADC_PIPELINE_FIFO_FRACTION_BITS;
+	for (size_t i = 0; i < config->block_size; ++i)
+	{
+		const uint32_t word = words[i * config->channels + channel];
+		if (ADC_PIPELINE_FIFO_SLOT(word) != channel)
+			pipeline->stats.slot_errors += 1;
+
+		const uint32_t data = ADC_PIPELINE_FIFO_DATA(word);
+		int32_t value;
+		if (config->differential)
+		{
+			// Two's complement, move the sign bit to bit 31 and back
+			value = (int32_t)(data << (32 - bits)) >> (32 - bits);
+		}
+		else
+		{
+			// Offset binary, centre it on zero
+			value = (int32_t)data - (1 << (bits - 1));
+		}
+		pipeline->input[i] = bits > 16 ? value >> (bits - 16) :
+			value * (1 << (16 - bits));
+	}
+}
+
+// Tracks the mean of the channel across blocks and subtracts it
+static void adc_pipeline_remove_dc(
+	struct adc_pipeline *pipeline, struct adc_pipeline_channel *channel
+)
+{
+	const struct adc_pipeline_config *config = &pipeline->config;
+	q15_t mean;
+	arm_mean_q15(pipeline->input, config->block_size, &mean);
+	channel->dc += (int32_t)(((int64_t)mean * 65536 - channel->dc) >>
+		config->dc_shift);
+	const q15_t offset = adc_pipeline_saturate(-((channel->dc + 0x8000) >> 16));
+	arm_offset_q15(
+		pipeline->input, offset, pipeline->input, config->block_size
+	);
+}
+
+// CIC decimation in place, returns the number of samples left. Integrators
+// and combs wrap around, which the differences cancel out
+static size_t adc_pipeline_cic(
+	struct adc_pipeline *pipeline, struct adc_pipeline_channel *channel
+)
+{
+	const struct adc_pipeline_config *config = &pipeline->config;
+	const unsigned gain_bits =
+		config->cic_stages * adc_pipeline_log2(config->cic_decimation);
+	size_t out = 0;
+	for (size_t i = 0; i < config->block_size; ++i)
+	{
+		uint32_t value = (uint32_t)(int32_t)pipeline->input[i];
+		for (size_t stage = 0; stage < config->cic_stages; ++stage)
+		{
+			channel->integrators[stage] += value;
+			value = channel->integrators[stage];
+		}
+		if ((i + 1) % config->cic_decimation)
+			continue;
+
+		for (size_t stage = 0; stage < config->cic_stages; ++stage)
+		{
+			const uint32_t previous = channel->combs[stage];
+			channel->combs[stage] = value;
+			value -= previous;
+		}
+		pipeline->input[out++] =
+			adc_pipeline_saturate((int32_t)value >> gain_bits);
+	}
+	return out;
+}
+
+size_t adc_pipeline_process(
+	struct adc_pipeline *pipeline,
+	const uint32_t *words,
+	size_t count,
+	q15_t *frames
+)
+{
+	const struct adc_pipeline_config *config = &pipeline->config;
+	const size_t block_words = (size_t)config->block_size * config->channels;
+	const size_t block_frames = adc_pipeline_block_frames(pipeline);
+	size_t written = 0;
+	for (; count >= block_words; count -= block_words, words += block_words)
+	{
+		for (uint8_t i = 0; i < config->channels; ++i)
+		{
+			struct adc_pipeline_channel *channel = &pipeline->channels[i];
+			adc_pipeline_gather(pipeline, words, i);
+			if (config->dc_shift)
+				adc_pipeline_remove_dc(pipeline, channel);
+
+			size_t size = config->block_size;
+			if (config->cic_stages)
+				size = adc_pipeline_cic(pipeline, channel);
+
+			const q15_t *result = pipeline->input;
+			if (config->fir_taps)
+			{
+				arm_fir_decimate_q15(
+					&channel->fir, pipeline->input, pipeline->output, size
+				);
+				result = pipeline->output;
+			}
+
+			for (size_t frame = 0; frame < block_frames; ++frame)
+			{
+				frames[(written + frame) * config->channels + i] =
+					result[frame];
+			}
+		}
+		written += block_frames;
+		pipeline->stats.blocks += 1;
+	}
+	return written;
+}
+
+void adc_pipeline_get_stats(
+	const struct adc_pipeline *pipeline, struct adc_pipeline_stats *stats
+)
+{
+	*stats = pipeline->stats;
+}
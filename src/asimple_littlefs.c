@@ -6,14 +6,28 @@
 #include <asimple_littlefs.h>
 #include <flash.h>
 
+#include <stdbool.h>
+
+// Only programs and erases leave the chip busy, so only poll the status
+// register if one of those is still outstanding
+static void asimple_lfs_wait(struct asimple_littlefs *fs)
+{
+	if (fs->busy)
+	{
+		flash_wait_busy(fs->flash);
+		fs->busy = false;
+	}
+}
+
 static int asimple_lfs_read(
 	const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer,
 	lfs_size_t size
 )
 {
 	struct asimple_littlefs *fs = c->context;
-	flash_wait_busy(fs->flash);
-	flash_read_data(fs->flash, c->block_size * block + off, buffer, size);
+	asimple_lfs_wait(fs);
+	if (!flash_read_data(fs->flash, c->block_size * block + off, buffer, size))
+		return LFS_ERR_IO;
 	return 0;
 }
 
@@ -23,45 +37,108 @@ static int asimple_lfs_prog(
 )
 {
 	struct asimple_littlefs *fs = c->context;
-	flash_wait_busy(fs->flash);
-	flash_write_enable(fs->flash);
-	flash_page_program(fs->flash, c->block_size * block + off, buffer, size);
+	asimple_lfs_wait(fs);
+	// flash_page_program issues the write enable itself
+	uint32_t addr = c->block_size * block + off;
+	if (!flash_page_program(fs->flash, addr, buffer, size))
+		return LFS_ERR_IO;
+	fs->busy = true;
 	return 0;
 }
 
 static int asimple_lfs_erase(const struct lfs_config *c, lfs_block_t block)
 {
 	struct asimple_littlefs *fs = c->context;
-	flash_wait_busy(fs->flash);
-	flash_sector_erase(fs->flash, block * c->block_size);
+	asimple_lfs_wait(fs);
+	if (!flash_sector_erase(fs->flash, block * c->block_size))
+		return LFS_ERR_IO;
+	fs->busy = true;
 	return 0;
 }
 
 static int asimple_lfs_sync(const struct lfs_config *c)
 {
 	struct asimple_littlefs *fs = c->context;
-	flash_wait_busy(fs->flash);
+	asimple_lfs_wait(fs);
 	return 0;
 }
 
-void asimple_littlefs_init(struct asimple_littlefs *fs, struct flash *flash)
+bool asimple_littlefs_init(
+	struct asimple_littlefs *fs,
+	struct flash *flash,
+	const struct asimple_littlefs_config *config
+)
 {
+	static const struct asimple_littlefs_config defaults = {0};
+	if (!config)
+		config = &defaults;
+
 	fs->flash = flash;
-	const struct lfs_config config = {
+	// We don't know what the chip was doing before, so check once
+	fs->busy = true;
+	// Blocks are the smallest erasable unit of the chip, and we program up to
+	// a page at a time
+	const struct flash_info *info = &flash->info;
+	uint32_t block_size = info->erase[0].size;
+	uint32_t block_count = info->size / block_size;
+
+	uint32_t cache_size = config->cache_size;
+	if (!cache_size)
+		cache_size = info->page_size;
+
+	// One bit per block, in multiples of 8 bytes as littlefs wants
+	uint32_t lookahead_size = config->lookahead_size;
+	if (!lookahead_size)
+	{
+		lookahead_size = ((block_count + 63) / 64) * 8;
+		if (!config->lookahead_buffer &&
+			lookahead_size > ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE)
+			lookahead_size = ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE;
+	}
+
+	// Even with caller buffers, the per-file caches of the littlefs syscalls
+	// are ASIMPLE_LITTLEFS_MAX_CACHE_SIZE bytes, and littlefs fills
+	// cache_size bytes of them
+	if (cache_size > ASIMPLE_LITTLEFS_MAX_CACHE_SIZE)
+		return false;
+
+	void *read_buffer = config->read_buffer;
+	void *prog_buffer = config->prog_buffer;
+	void *lookahead_buffer = config->lookahead_buffer;
+	if (!lookahead_buffer &&
+		lookahead_size > ASIMPLE_LITTLEFS_MAX_LOOKAHEAD_SIZE)
+		return false;
+	if (!read_buffer)
+		read_buffer = fs->read_buffer;
+	if (!prog_buffer)
+		prog_buffer = fs->prog_buffer;
+	if (!lookahead_buffer)
+		lookahead_buffer = fs->lookahead_buffer;
+
+	// littlefs requirements on the cache and lookahead sizes
+	if (cache_size % info->page_size || block_size % cache_size ||
+		lookahead_size % 8)
+		return false;
+
+	const struct lfs_config lfs_config = {
 		.read = asimple_lfs_read,
 		.prog = asimple_lfs_prog,
 		.erase = asimple_lfs_erase,
 		.sync = asimple_lfs_sync,
 		.read_size = 1,
-		.prog_size = 256,
-		.block_size = 4096,
-		.block_count = 512,
-		.cache_size = 256,
-		.lookahead_size = 8192,
-		.block_cycles = 250,
+		.prog_size = info->page_size,
+		.block_size = block_size,
+		.block_count = block_count,
+		.cache_size = cache_size,
+		.lookahead_size = lookahead_size,
+		.block_cycles = config->block_cycles ? config->block_cycles : 250,
+		.read_buffer = read_buffer,
+		.prog_buffer = prog_buffer,
+		.lookahead_buffer = lookahead_buffer,
 		.context = fs,
 	};
-	fs->config = config;
+	fs->config = lfs_config;
+	return true;
 }
 
 int asimple_littlefs_format(struct asimple_littlefs *fs)
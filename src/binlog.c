@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <binlog.h>
+#include <systick.h>
+#include <telemetry.h>
+
+#include <unistd.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static_assert(
+	(BINLOG_BUFFER_WORDS & (BINLOG_BUFFER_WORDS - 1)) == 0,
+	"BINLOG_BUFFER_WORDS must be a power of two"
+);
+
+#define BINLOG_VALID 0x80000000u
+
+// Producers (any context, including interrupts) reserve space by moving head
+// forward with a CAS, fill in the record, and publish it by writing its
+// header word last. The consumer stops at the first header that is still zero,
+// and zeroes everything it consumes before moving tail forward. Indices are
+// free-running and wrap around the ring.
+static atomic_uint_least32_t ring[BINLOG_BUFFER_WORDS];
+static atomic_uint head;
+static atomic_uint tail;
+static atomic_uint dropped;
+
+void binlog_write(const char *format, const uint32_t *args, size_t count)
+{
+	const unsigned words = 2 + count;
+	unsigned start = atomic_load_explicit(&head, memory_order_relaxed);
+	do
+	{
+		unsigned end = atomic_load_explicit(&tail, memory_order_acquire);
+		if (start - end + words > BINLOG_BUFFER_WORDS)
+		{
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		}
+	}
+	while (!atomic_compare_exchange_weak_explicit(
+		&head, &start, start + words, memory_order_relaxed, memory_order_relaxed
+	));
+
+	const uint32_t timestamp = systick_started() ? systick_jiffies() : 0;
+	atomic_store_explicit(
+		&ring[(start + 1) % BINLOG_BUFFER_WORDS],
+		timestamp,
+		memory_order_relaxed
+	);
+	for (size_t i = 0; i < count; ++i)
+	{
+		atomic_store_explicit(
+			&ring[(start + 2 + i) % BINLOG_BUFFER_WORDS],
+			args[i],
+			memory_order_relaxed
+		);
+	}
+
+	const uint32_t header = BINLOG_VALID | (uint32_t)count << 24 |
+		((uintptr_t)format & 0xFFFFFF);
+	atomic_store_explicit(
+		&ring[start % BINLOG_BUFFER_WORDS], header, memory_order_release
+	);
+}
+
+size_t binlog_drain(binlog_sink sink, void *context)
+{
+	size_t drained = 0;
+	unsigned start = atomic_load_explicit(&tail, memory_order_relaxed);
+	for (;;)
+	{
+		uint32_t header = atomic_load_explicit(
+			&ring[start % BINLOG_BUFFER_WORDS], memory_order_acquire
+		);
+		// Either nothing is left, or the next record is still being written
+		if (!(header & BINLOG_VALID))
+			break;
+
+		uint32_t record[BINLOG_MAX_RECORD_WORDS];
+		const unsigned words = 2 + ((header >> 24) & 0x7);
+		record[0] = header;
+		for (unsigned i = 1; i < words; ++i)
+		{
+			record[i] = atomic_load_explicit(
+				&ring[(start + i) % BINLOG_BUFFER_WORDS], memory_order_relaxed
+			);
+		}
+		if (!sink(context, record, words))
+			break;
+
+		for (unsigned i = 0; i < words; ++i)
+		{
+			atomic_store_explicit(
+				&ring[(start + i) % BINLOG_BUFFER_WORDS],
+				0,
+				memory_order_relaxed
+			);
+		}
+		start += words;
+		atomic_store_explicit(&tail, start, memory_order_release);
+		drained += 1;
+	}
+	return drained;
+}
+
+bool binlog_sink_telemetry(
+	void *telemetry, const uint32_t *record, size_t words
+)
+{
+	telemetry_send(
+		telemetry, BINLOG_TELEMETRY_CHANNEL, record, words * sizeof(*record)
+	);
+	return true;
+}
+
+bool binlog_sink_fd(void *fd, const uint32_t *record, size_t words)
+{
+	const size_t size = words * sizeof(*record);
+	return write(*(int *)fd, record, size) == (ssize_t)size;
+}
+
+uint32_t binlog_dropped(void)
+{
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
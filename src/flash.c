@@ -4,6 +4,7 @@
 // SPDX-FileCopyrightText: Melody Gill, 2023
 
 #include <flash.h>
+#include <mspi.h>
 #include <spi.h>
 
 #include <am_bsp.h>
@@ -15,13 +16,50 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Defaults match the 2 MiB chip this library was originally written against
+static const struct flash_info default_info = {
+	.jedec_id = 0,
+	.sfdp = false,
+	.size = 512 * 4096,
+	.page_size = 256,
+	.page_program_us = 0,
+	.chip_erase_ms = 0,
+	.erase =
+		{
+			{.size = 4096, .opcode = 0x20, .typical_ms = 0},
+		},
+	.read = {.opcode = 0x03, .dummy_clocks = 0, .mode_clocks = 0},
+};
+
 void flash_init(struct flash *flash, struct spi_device *device)
 {
 	flash->spi = device;
+	flash->mspi = NULL;
+	flash->quad = false;
+	flash->info = default_info;
+}
+
+void flash_init_mspi(struct flash *flash, struct mspi *mspi)
+{
+	flash->spi = NULL;
+	flash->mspi = mspi;
+	flash->quad = false;
+	flash->info = default_info;
+	mspi_configure_data(
+		mspi, MSPI_DATA_WIDTH_1, flash->info.read.opcode,
+		flash->info.read.dummy_clocks, 0x02
+	);
 }
 
 uint8_t flash_read_status_register(struct flash *flash)
 {
+	if (flash->mspi)
+	{
+		uint8_t status = 0;
+		mspi_command_read(flash->mspi, 0x05, false, 0, 0, &status, 1);
+		return status;
+	}
+
 	uint8_t writeBuffer = 0x05;
 	spi_device_write_continue(flash->spi, &writeBuffer, 1);
 	uint8_t readBuffer = 0;
@@ -31,6 +69,15 @@ uint8_t flash_read_status_register(struct flash *flash)
 
 void flash_wait_busy(struct flash *flash)
 {
+	// The MSPI can't hold CS between transactions, so poll with complete
+	// status register reads
+	if (flash->mspi)
+	{
+		while (flash_read_status_register(flash) & 0x01)
+			;
+		return;
+	}
+
 	uint8_t writeBuffer = 0x05;
 	spi_device_write_continue(flash->spi, &writeBuffer, 1);
 	uint8_t readBuffer = 0;
@@ -47,24 +94,64 @@ void flash_wait_busy(struct flash *flash)
 
 void flash_write_enable(struct flash *flash)
 {
+	if (flash->mspi)
+	{
+		mspi_command_write(flash->mspi, 0x06, false, 0, NULL, 0);
+		return;
+	}
+
 	uint8_t writeBuffer = 0x06;
 	spi_device_write(flash->spi, &writeBuffer, 1);
 }
 
-void flash_read_data(
+uint8_t flash_read_data(
 	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
 )
 {
-	// Write command as least significant bit
+	if (flash->mspi)
+	{
+		return mspi_data_read(flash->mspi, addr, buffer, size);
+	}
+
+	// Write command as least significant bit, followed by a dummy byte if the
+	// read command requires one (fast read does)
 	uint8_t toWrite[] = {
-		0x03,
+		flash->info.read.opcode,
 		addr >> 16,
 		addr >> 8,
 		addr,
+		0x00,
 	};
-	static_assert(sizeof(toWrite) == 4, "guessed array size wrong");
+	static_assert(sizeof(toWrite) == 5, "guessed array size wrong");
 
-	spi_device_write_continue(flash->spi, toWrite, 4);
+	spi_device_write_continue(
+		flash->spi, toWrite, 4 + flash->info.read.dummy_clocks / 8
+	);
+	spi_device_read(flash->spi, buffer, size);
+	return 1;
+}
+
+void flash_read_sfdp(
+	struct flash *flash, uint32_t addr, uint8_t *buffer, uint32_t size
+)
+{
+	// The SFDP read command always takes 8 dummy clocks after the address
+	if (flash->mspi)
+	{
+		mspi_command_read(flash->mspi, 0x5A, true, addr, 8, buffer, size);
+		return;
+	}
+
+	uint8_t toWrite[] = {
+		0x5A,
+		addr >> 16,
+		addr >> 8,
+		addr,
+		0x00,
+	};
+	static_assert(sizeof(toWrite) == 5, "guessed array size wrong");
+
+	spi_device_write_continue(flash->spi, toWrite, 5);
 	spi_device_read(flash->spi, buffer, size);
 }
 
@@ -85,6 +172,11 @@ uint8_t flash_page_program(
 		return 0;
 	}
 
+	if (flash->mspi)
+	{
+		return mspi_data_write(flash->mspi, addr, buffer, size);
+	}
+
 	// Write command as least significant bit
 	uint8_t toWrite[4] = {
 		0x02,
@@ -99,7 +191,8 @@ uint8_t flash_page_program(
 	return 1;
 }
 
-uint8_t flash_sector_erase(struct flash *flash, uint32_t addr)
+static uint8_t
+flash_erase_command(struct flash *flash, uint8_t opcode, uint32_t addr)
 {
 	// Enable writing and check that status register updated
 	flash_write_enable(flash);
@@ -114,9 +207,15 @@ uint8_t flash_sector_erase(struct flash *flash, uint32_t addr)
 		return 0;
 	}
 
+	if (flash->mspi)
+	{
+		mspi_command_write(flash->mspi, opcode, true, addr, NULL, 0);
+		return 1;
+	}
+
 	// Write command as least significant bit
 	uint8_t toWrite[4] = {
-		0x20,
+		opcode,
 		addr >> 16,
 		addr >> 8,
 		addr,
@@ -125,12 +224,259 @@ uint8_t flash_sector_erase(struct flash *flash, uint32_t addr)
 	return 1;
 }
 
+uint8_t flash_sector_erase(struct flash *flash, uint32_t addr)
+{
+	return flash_erase_command(flash, flash->info.erase[0].opcode, addr);
+}
+
+uint8_t flash_erase(struct flash *flash, uint32_t addr, uint32_t size)
+{
+	const struct flash_erase_type *erase = flash->info.erase;
+	for (size_t i = 0; i < 4 && erase[i].size; ++i)
+	{
+		if (erase[i].size == size)
+			return flash_erase_command(flash, erase[i].opcode, addr);
+	}
+	return 0;
+}
+
 uint32_t flash_read_id(struct flash *flash)
 {
-	uint8_t writeBuffer = 0x9F;
-	spi_device_write_continue(flash->spi, &writeBuffer, 1);
 	uint8_t readBuffer[3] = {0};
-	spi_device_read(flash->spi, readBuffer, 3);
+	if (flash->mspi)
+	{
+		mspi_command_read(flash->mspi, 0x9F, false, 0, 0, readBuffer, 3);
+	}
+	else
+	{
+		uint8_t writeBuffer = 0x9F;
+		spi_device_write_continue(flash->spi, &writeBuffer, 1);
+		spi_device_read(flash->spi, readBuffer, 3);
+	}
 	uint32_t result = readBuffer[0] << 16 | readBuffer[1] << 8 | readBuffer[2];
 	return result;
 }
+
+// Reads the JESD216 DWORD with the given 1-based index from the table
+static uint32_t sfdp_dword(const uint8_t *table, size_t index)
+{
+	const uint8_t *dword = table + (index - 1) * 4;
+	return (uint32_t)dword[0] | (uint32_t)dword[1] << 8 |
+		   (uint32_t)dword[2] << 16 | (uint32_t)dword[3] << 24;
+}
+
+// Decodes a 16-bit fast read field: dummy clocks in bits 4:0, mode clocks in
+// bits 7:5, and the opcode in bits 15:8. A zero opcode means unsupported.
+static struct flash_read_mode sfdp_read_mode(uint32_t field, bool supported)
+{
+	struct flash_read_mode mode = {0};
+	if (supported)
+	{
+		mode.dummy_clocks = field & 0x1F;
+		mode.mode_clocks = (field >> 5) & 0x7;
+		mode.opcode = (field >> 8) & 0xFF;
+	}
+	return mode;
+}
+
+// Decodes a 7-bit typical erase time field: count in bits 4:0, units in bits
+// 6:5
+static uint32_t sfdp_erase_time_ms(uint32_t field)
+{
+	static const uint32_t units[] = {1, 16, 128, 1000};
+	return ((field & 0x1F) + 1) * units[(field >> 5) & 0x3];
+}
+
+// Sets the quad enable bit, following the procedure the SFDP table asks for
+static bool flash_set_quad_enable(struct flash *flash)
+{
+	uint8_t status[2] = {0};
+	switch (flash->info.quad_enable)
+	{
+	case FLASH_QUAD_ENABLE_NONE:
+		return true;
+	case FLASH_QUAD_ENABLE_SR2_BIT1_NO_READ:
+	case FLASH_QUAD_ENABLE_SR2_BIT1_NO_READ_SAFE:
+		// Status register 2 can't be read back, so it gets overwritten
+		status[0] = flash_read_status_register(flash);
+		status[1] = 0x02;
+		flash_write_enable(flash);
+		mspi_command_write(flash->mspi, 0x01, false, 0, status, 2);
+		break;
+	case FLASH_QUAD_ENABLE_SR1_BIT6:
+		status[0] = flash_read_status_register(flash);
+		if (status[0] & 0x40)
+			return true;
+		status[0] |= 0x40;
+		flash_write_enable(flash);
+		mspi_command_write(flash->mspi, 0x01, false, 0, status, 1);
+		break;
+	case FLASH_QUAD_ENABLE_SR2_BIT7:
+		mspi_command_read(flash->mspi, 0x3F, false, 0, 0, status, 1);
+		if (status[0] & 0x80)
+			return true;
+		status[0] |= 0x80;
+		flash_write_enable(flash);
+		mspi_command_write(flash->mspi, 0x3E, false, 0, status, 1);
+		break;
+	case FLASH_QUAD_ENABLE_SR2_BIT1:
+		status[0] = flash_read_status_register(flash);
+		mspi_command_read(flash->mspi, 0x35, false, 0, 0, status + 1, 1);
+		if (status[1] & 0x02)
+			return true;
+		status[1] |= 0x02;
+		flash_write_enable(flash);
+		mspi_command_write(flash->mspi, 0x01, false, 0, status, 2);
+		break;
+	case FLASH_QUAD_ENABLE_SR2_BIT1_SEPARATE:
+		mspi_command_read(flash->mspi, 0x35, false, 0, 0, status, 1);
+		if (status[0] & 0x02)
+			return true;
+		status[0] |= 0x02;
+		flash_write_enable(flash);
+		mspi_command_write(flash->mspi, 0x31, false, 0, status, 1);
+		break;
+	default:
+		// No way to know how to turn on the quad lines
+		return false;
+	}
+	flash_wait_busy(flash);
+	return true;
+}
+
+// Picks the fastest data commands both the chip and the MSPI support
+static void flash_configure_mspi(struct flash *flash)
+{
+	const struct flash_info *info = &flash->info;
+	const struct flash_read_mode *quad = &info->read_1_1_4;
+	flash->quad = quad->opcode && flash_set_quad_enable(flash);
+	if (flash->quad)
+	{
+		// 0x32 is the 1-1-4 page program on every part with a 1-1-4 read we
+		// know of, SFDP doesn't describe program commands
+		mspi_configure_data(
+			flash->mspi, MSPI_DATA_WIDTH_4, quad->opcode,
+			quad->dummy_clocks + quad->mode_clocks, 0x32
+		);
+	}
+	else
+	{
+		mspi_configure_data(
+			flash->mspi, MSPI_DATA_WIDTH_1, info->read.opcode,
+			info->read.dummy_clocks, 0x02
+		);
+	}
+}
+
+bool flash_detect(struct flash *flash)
+{
+	struct flash_info *info = &flash->info;
+	info->jedec_id = flash_read_id(flash);
+
+	// SFDP header followed by the first parameter header, which is always the
+	// basic flash parameter table
+	uint8_t header[16];
+	flash_read_sfdp(flash, 0, header, sizeof(header));
+	if (memcmp(header, "SFDP", 4) != 0 || header[8] != 0x00)
+		return false;
+
+	// The basic table is at least 9 DWORDs long (JESD216), newer revisions
+	// add the timing, page size, and quad enable DWORDs we also care about
+	size_t length = header[11];
+	uint32_t pointer = header[12] | header[13] << 8 | header[14] << 16;
+	if (length < 9)
+		return false;
+	if (length > 15)
+		length = 15;
+	uint8_t table[15 * 4];
+	flash_read_sfdp(flash, pointer, table, length * 4);
+
+	uint32_t dword1 = sfdp_dword(table, 1);
+	uint32_t dword2 = sfdp_dword(table, 2);
+
+	// Density is in bits, either as N-1 or as a power of two
+	uint64_t bits;
+	if (dword2 & 0x80000000u)
+	{
+		uint32_t exponent = dword2 & 0x7FFFFFFFu;
+		bits = exponent < 63 ? (uint64_t)1 << exponent : UINT64_MAX;
+	}
+	else
+	{
+		bits = (uint64_t)dword2 + 1;
+	}
+	uint64_t size = bits / 8;
+	// We only do 3-byte addressing
+	if (size > (1u << 24))
+		size = 1u << 24;
+	info->size = size;
+
+	uint32_t dword3 = sfdp_dword(table, 3);
+	uint32_t dword4 = sfdp_dword(table, 4);
+	info->read_1_4_4 = sfdp_read_mode(dword3, dword1 & (1u << 21));
+	info->read_1_1_4 = sfdp_read_mode(dword3 >> 16, dword1 & (1u << 22));
+	info->read_1_1_2 = sfdp_read_mode(dword4, dword1 & (1u << 16));
+	info->read_1_2_2 = sfdp_read_mode(dword4 >> 16, dword1 & (1u << 20));
+
+	// Fast read isn't described by the table, but every part with an SFDP
+	// table supports it, and it is good past the clock limit of the plain
+	// read command
+	info->read.opcode = 0x0B;
+	info->read.dummy_clocks = 8;
+	info->read.mode_clocks = 0;
+
+	// Erase types 1-4, with their typical times if the table has them
+	uint32_t times = length >= 10 ? sfdp_dword(table, 10) : 0;
+	struct flash_erase_type erase[4] = {0};
+	size_t erase_count = 0;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		uint32_t field = sfdp_dword(table, 8 + i / 2) >> (16 * (i % 2));
+		uint8_t exponent = field & 0xFF;
+		if (exponent == 0 || exponent > 31)
+			continue;
+		struct flash_erase_type type = {
+			.size = 1u << exponent,
+			.opcode = (field >> 8) & 0xFF,
+			.typical_ms =
+				length >= 10 ? sfdp_erase_time_ms(times >> (4 + 7 * i)) : 0,
+		};
+		// Insertion sort, smallest erase first
+		size_t j = erase_count++;
+		for (; j > 0 && erase[j - 1].size > type.size; --j)
+			erase[j] = erase[j - 1];
+		erase[j] = type;
+	}
+
+	// Old tables may only describe the 4K erase in the first DWORD
+	if (erase_count == 0 && (dword1 & 0x3) == 0x1)
+	{
+		erase[0].size = 4096;
+		erase[0].opcode = (dword1 >> 8) & 0xFF;
+		erase_count = 1;
+	}
+	if (erase_count)
+		memcpy(info->erase, erase, sizeof(erase));
+
+	if (length >= 11)
+	{
+		uint32_t dword11 = sfdp_dword(table, 11);
+		info->page_size = 1u << ((dword11 >> 4) & 0xF);
+		info->page_program_us =
+			(((dword11 >> 8) & 0x1F) + 1) * ((dword11 & (1u << 13)) ? 64 : 8);
+		static const uint32_t chip_units[] = {16, 256, 4000, 64000};
+		info->chip_erase_ms =
+			(((dword11 >> 24) & 0x1F) + 1) * chip_units[(dword11 >> 29) & 0x3];
+	}
+
+	// Quad enable requirements, bits 22:20 of the 15th DWORD (JESD216A)
+	info->quad_enable = length >= 15
+		? (enum flash_quad_enable)((sfdp_dword(table, 15) >> 20) & 0x7)
+		: FLASH_QUAD_ENABLE_UNKNOWN;
+
+	info->sfdp = true;
+
+	if (flash->mspi)
+		flash_configure_mspi(flash);
+	return true;
+}
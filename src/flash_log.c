@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <crc32.h>
+#include <flash.h>
+#include <flash_log.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FLASH_LOG_MAGIC 0x474F4C46u // "FLOG"
+
+// Start of every sector, the CRC covers the magic and sequence number
+struct flash_log_header
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t crc;
+};
+
+// Start of every record, check is the complement of the length so a torn or
+// erased header can't pass as a record
+struct flash_log_record
+{
+	uint16_t length;
+	uint16_t check;
+	uint32_t crc;
+};
+
+static_assert(sizeof(struct flash_log_header) == 12, "unexpected padding");
+static_assert(sizeof(struct flash_log_record) == 8, "unexpected padding");
+
+static uint32_t sector_address(const struct flash_log *log, uint32_t index)
+{
+	return log->start + index * log->sector_size;
+}
+
+// Maps a sequence number of a sector still in the log to its index
+static uint32_t sector_index(const struct flash_log *log, uint32_t seq)
+{
+	uint32_t back = (log->head_seq - seq) % log->sector_count;
+	return (log->head + log->sector_count - back) % log->sector_count;
+}
+
+// Only programs and erases leave the chip busy
+static void flash_log_wait(struct flash_log *log)
+{
+	if (log->busy)
+	{
+		flash_wait_busy(log->flash);
+		log->busy = false;
+	}
+}
+
+// Reads from the flash, patching in anything still in the page buffer
+static void flash_log_read(
+	struct flash_log *log, uint32_t addr, void *buffer, uint32_t size
+)
+{
+	flash_log_wait(log);
+	flash_read_data(log->flash, addr, buffer, size);
+
+	uint32_t begin = log->page_addr + log->page_begin;
+	uint32_t end = log->page_addr + log->page_end;
+	if (addr + size <= begin || addr >= end)
+		return;
+	uint32_t from = addr > begin ? addr : begin;
+	uint32_t to = addr + size < end ? addr + size : end;
+	memcpy(
+		(uint8_t *)buffer + (from - addr),
+		log->page + (from - log->page_addr),
+		to - from
+	);
+}
+
+static bool flash_log_flush(struct flash_log *log)
+{
+	if (log->page_end == log->page_begin)
+		return true;
+	flash_log_wait(log);
+	if (!flash_page_program(
+			log->flash,
+			log->page_addr + log->page_begin,
+			log->page + log->page_begin,
+			log->page_end - log->page_begin
+		))
+		return false;
+	log->busy = true;
+	log->page_begin = log->page_end;
+	return true;
+}
+
+// Appends bytes at the head, programming every page as soon as it fills up
+static bool
+flash_log_write(struct flash_log *log, const void *data, uint32_t size)
+{
+	const uint8_t *bytes = data;
+	while (size)
+	{
+		if (log->page_end == log->page_size)
+		{
+			log->page_addr += log->page_size;
+			log->page_begin = 0;
+			log->page_end = 0;
+		}
+		uint32_t chunk = log->page_size - log->page_end;
+		if (chunk > size)
+			chunk = size;
+		memcpy(log->page + log->page_end, bytes, chunk);
+		log->page_end += chunk;
+		log->head_offset += chunk;
+		bytes += chunk;
+		size -= chunk;
+		if (log->page_end == log->page_size && !flash_log_flush(log))
+			return false;
+	}
+	return true;
+}
+
+// Points the page buffer at the head, with nothing buffered
+static void flash_log_seek_head(struct flash_log *log)
+{
+	uint32_t addr = sector_address(log, log->head) + log->head_offset;
+	log->page_addr = addr & ~(log->page_size - 1);
+	log->page_begin = addr - log->page_addr;
+	log->page_end = log->page_begin;
+}
+
+// Erases the given sector and makes it the head
+static bool flash_log_open_sector(
+	struct flash_log *log, uint32_t index, uint32_t seq
+)
+{
+	if (!flash_log_flush(log))
+		return false;
+	flash_log_wait(log);
+	if (!flash_sector_erase(log->flash, sector_address(log, index)))
+		return false;
+	log->busy = true;
+
+	log->head = index;
+	log->head_seq = seq;
+	log->head_offset = 0;
+	flash_log_seek_head(log);
+
+	struct flash_log_header header = {
+		.magic = FLASH_LOG_MAGIC,
+		.seq = seq,
+		.crc = 0,
+	};
+	header.crc = crc32(&header, offsetof(struct flash_log_header, crc));
+	return flash_log_write(log, &header, sizeof(header));
+}
+
+// Reads the header of the given sector, returning whether it is valid
+static bool
+flash_log_header(struct flash_log *log, uint32_t index, uint32_t *seq)
+{
+	struct flash_log_header header;
+	flash_log_read(log, sector_address(log, index), &header, sizeof(header));
+	if (header.magic != FLASH_LOG_MAGIC ||
+		header.crc != crc32(&header, offsetof(struct flash_log_header, crc)))
+		return false;
+	*seq = header.seq;
+	return true;
+}
+
+// Whether the sector holds the expected sequence number
+static bool
+flash_log_sector_is(struct flash_log *log, uint32_t index, uint32_t seq)
+{
+	uint32_t found;
+	return flash_log_header(log, index, &found) && found == seq;
+}
+
+// Finds where the next record goes in the head sector
+static void flash_log_scan_head(struct flash_log *log)
+{
+	uint32_t offset = sizeof(struct flash_log_header);
+	uint32_t addr = sector_address(log, log->head);
+	while (offset + sizeof(struct flash_log_record) <= log->sector_size)
+	{
+		struct flash_log_record record;
+		flash_log_read(log, addr + offset, &record, sizeof(record));
+		if (record.length == 0xFFFF && record.check == 0xFFFF)
+			break;
+		// A torn record header leaves no way to know where the next record
+		// goes, so give up on the rest of the sector
+		if (record.length + record.check != 0xFFFF ||
+			offset + sizeof(record) + record.length > log->sector_size)
+		{
+			offset = log->sector_size;
+			break;
+		}
+		offset += sizeof(record) + record.length;
+	}
+	log->head_offset = offset;
+}
+
+static void flash_log_recover(struct flash_log *log)
+{
+	// Sectors are written in order, so starting from the first sector the
+	// sequence numbers go up by one until the head. The first sector may have
+	// been caught mid-erase when the log wrapped, in which case the second one
+	// starts the run.
+	uint32_t base;
+	uint32_t base_seq;
+	if (flash_log_header(log, 0, &base_seq))
+		base = 0;
+	else if (flash_log_header(log, 1, &base_seq))
+		base = 1;
+	else
+	{
+		log->empty = true;
+		return;
+	}
+
+	uint32_t low = base;
+	uint32_t high = log->sector_count - 1;
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low + 1) / 2;
+		if (flash_log_sector_is(log, mid, base_seq + (mid - base)))
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	log->empty = false;
+	log->head = low;
+	log->head_seq = base_seq + (low - base);
+
+	// Past the head is either erased flash (the log hasn't wrapped yet) or
+	// the oldest sector. One sector may have been caught mid-erase.
+	log->tail = base;
+	log->tail_seq = base_seq;
+	for (uint32_t i = 1; i <= 2 && i < log->sector_count; ++i)
+	{
+		uint32_t index = (log->head + i) % log->sector_count;
+		uint32_t seq = log->head_seq - (log->sector_count - i);
+		if (index == base)
+			break;
+		if (flash_log_sector_is(log, index, seq))
+		{
+			log->tail = index;
+			log->tail_seq = seq;
+			break;
+		}
+	}
+
+	flash_log_scan_head(log);
+}
+
+bool flash_log_init(
+	struct flash_log *log, struct flash *flash, uint32_t start, uint32_t size
+)
+{
+	uint32_t sector_size = flash->info.erase[0].size;
+	uint32_t page_size = flash->info.page_size;
+	if (!sector_size || start % sector_size || size % sector_size ||
+		size / sector_size < 2 || page_size > FLASH_LOG_MAX_PAGE_SIZE ||
+		sector_size % page_size)
+		return false;
+
+	log->flash = flash;
+	log->start = start;
+	log->sector_size = sector_size;
+	log->sector_count = size / sector_size;
+	log->page_size = page_size;
+	// We don't know what the chip was doing before, so check once
+	log->busy = true;
+	log->head = 0;
+	log->head_seq = 0;
+	log->head_offset = 0;
+	log->tail = 0;
+	log->tail_seq = 0;
+	log->page_addr = start;
+	log->page_begin = 0;
+	log->page_end = 0;
+
+	flash_log_recover(log);
+	flash_log_seek_head(log);
+	return true;
+}
+
+uint32_t flash_log_max_record_size(const struct flash_log *log)
+{
+	uint32_t max = log->sector_size - sizeof(struct flash_log_header) -
+		sizeof(struct flash_log_record);
+	return max < 0xFFFF ? max : 0xFFFE;
+}
+
+bool flash_log_append(struct flash_log *log, const void *data, uint32_t size)
+{
+	if (size > flash_log_max_record_size(log))
+		return false;
+
+	uint32_t needed = sizeof(struct flash_log_record) + size;
+	if (log->empty)
+	{
+		if (!flash_log_open_sector(log, 0, 1))
+			return false;
+		log->empty = false;
+		log->tail = 0;
+		log->tail_seq = 1;
+	}
+	else if (log->head_offset + needed > log->sector_size)
+	{
+		// Records don't span sectors, move on to the next one, dropping the
+		// oldest sector if that's the one we're about to reuse
+		uint32_t next = (log->head + 1) % log->sector_count;
+		if (next == log->tail)
+		{
+			log->tail = (log->tail + 1) % log->sector_count;
+			log->tail_seq += 1;
+		}
+		if (!flash_log_open_sector(log, next, log->head_seq + 1))
+			return false;
+	}
+
+	struct flash_log_record record = {
+		.length = size,
+		.check = (uint16_t)~size,
+		.crc = crc32(data, size),
+	};
+	return flash_log_write(log, &record, sizeof(record)) &&
+		flash_log_write(log, data, size);
+}
+
+bool flash_log_sync(struct flash_log *log)
+{
+	if (!flash_log_flush(log))
+		return false;
+	flash_log_wait(log);
+	return true;
+}
+
+void flash_log_cursor_begin(
+	const struct flash_log *log, struct flash_log_cursor *cursor
+)
+{
+	cursor->seq = log->tail_seq;
+	cursor->offset = sizeof(struct flash_log_header);
+}
+
+int32_t flash_log_read_from(
+	struct flash_log *log,
+	struct flash_log_cursor *cursor,
+	void *buffer,
+	uint32_t size
+)
+{
+	if (log->empty)
+		return 0;
+
+	for (;;)
+	{
+		// Sequence numbers wrap, so compare them by their difference
+		if ((int32_t)(cursor->seq - log->tail_seq) < 0)
+		{
+			cursor->seq = log->tail_seq;
+			cursor->offset = sizeof(struct flash_log_header);
+		}
+		if ((int32_t)(cursor->seq - log->head_seq) > 0 ||
+			(cursor->seq == log->head_seq && cursor->offset >= log->head_offset))
+			return 0;
+
+		uint32_t addr =
+			sector_address(log, sector_index(log, cursor->seq)) + cursor->offset;
+		struct flash_log_record record;
+		bool valid = cursor->offset + sizeof(record) <= log->sector_size;
+		if (valid)
+		{
+			flash_log_read(log, addr, &record, sizeof(record));
+			valid = record.length + record.check == 0xFFFF &&
+				cursor->offset + sizeof(record) + record.length <=
+					log->sector_size;
+		}
+		if (!valid)
+		{
+			// No more records in this sector
+			cursor->seq += 1;
+			cursor->offset = sizeof(struct flash_log_header);
+			continue;
+		}
+
+		if (record.length > size)
+			return -1;
+		flash_log_read(log, addr + sizeof(record), buffer, record.length);
+		cursor->offset += sizeof(record) + record.length;
+		if (crc32(buffer, record.length) == record.crc)
+			return record.length;
+	}
+}
@@ -32,13 +32,15 @@ int main(void)
 	am_hal_sysctrl_fpu_stacking_enable(true);
 
 	// Init UART
-	uart = uart_get_instance(UART_INST0);
+	uart = uart_get_instance(UART_INST0, NULL);
 
 	// Initialize the ADC.
 	uint8_t pins[1];
 	pins[0] = 16;
 	size_t size = 1;
 	adc = adc_get_instance(pins, size);
+	struct adc_request request;
+	adc_prepare_request_pins(adc, &request, pins, size);
 
 	// After init is done, enable interrupts
 	am_hal_interrupt_master_enable();
@@ -144,23 +146,21 @@ int main(void)
 
 		// Print the battery voltage and temperature for each interrupt
 		uint32_t data[3] = {0};
-		if (adc_get_sample(adc, data, pins, size))
+		if (adc_get_sample_request(adc, data, &request))
 		{
-			// The math here is straight forward: we've asked the ADC to give
-			// us data in 14 bits (max value of 2^14 -1). We also specified the
-			// reference voltage to be 2.0V. A reading of 2.0V would be
-			// translated to the maximum value of 2^14-1. So we divide the
-			// value from the ADC by this maximum, and multiply it by the
-			// reference, which then gives us the actual voltage measured.
-			const double reference = 2.0;
-			double voltage = data[0] * reference / ((1 << 14) - 1);
-
-			double temperature =
-				5.506 -
-				sqrt(
-					(-5.506) * (-5.506) + 4 * 0.00176 * (870.6 - voltage * 1000)
+			// We've asked the ADC to give us data in 14 bits, with a 2.0V
+			// reference, so a reading of 2^14-1 is 2.0V.
+			const float millivolts =
+				adc_convert_millivolts(data[0], 14, ADC_CONVERT_REFERENCE_MV);
+
+			// Single precision, as doubles are emulated in software
+			float temperature =
+				5.506f -
+				sqrtf(
+					(-5.506f) * (-5.506f) +
+					4 * 0.00176f * (870.6f - millivolts)
 				);
-			temperature /= (2 * -.00176);
+			temperature /= (2 * -.00176f);
 			temperature += 30;
 
 			gpio_set(&lora_power, true);
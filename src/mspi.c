@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <mspi.h>
+
+#include <am_bsp.h>
+#include <am_mcu_apollo.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Timeout for blocking PIO transfers, in microseconds
+#define MSPI_TIMEOUT 1000000u
+
+// Largest transfer issued at once, bigger requests are split
+#define MSPI_MAX_TRANSFER 0x8000u
+
+// Size of the stack buffer PIO transfers go through, in words
+#define MSPI_PIO_WORDS 16
+
+struct mspi
+{
+	void *handle;
+	am_hal_mspi_dev_config_t config;
+	am_hal_mspi_device_e data_device;
+	uint8_t data_dummy_clocks;
+	bool reconfigure;
+	volatile bool dma_done;
+	volatile uint32_t dma_status;
+	atomic_uint refcount;
+};
+
+static struct mspi mspi_;
+
+// Command queue memory the HAL uses to run DMA transfers. We only ever have
+// one transfer in flight, so this doesn't need to be large.
+static uint32_t tcb_buffer[256];
+
+static am_hal_mspi_clock_e select_clock(uint32_t clock)
+{
+	if (clock >= 48000000u)
+		return AM_HAL_MSPI_CLK_48MHZ;
+	else if (clock >= 24000000u)
+		return AM_HAL_MSPI_CLK_24MHZ;
+	else if (clock >= 16000000u)
+		return AM_HAL_MSPI_CLK_16MHZ;
+	else if (clock >= 12000000u)
+		return AM_HAL_MSPI_CLK_12MHZ;
+	else if (clock >= 8000000u)
+		return AM_HAL_MSPI_CLK_8MHZ;
+	else if (clock >= 6000000u)
+		return AM_HAL_MSPI_CLK_6MHZ;
+	else if (clock >= 4000000u)
+		return AM_HAL_MSPI_CLK_4MHZ;
+	else // Any other clocks
+		return AM_HAL_MSPI_CLK_3MHZ;
+}
+
+// Reconfigures the device, but only if something actually changed, as the
+// module has to be disabled to change its configuration
+static void mspi_apply(
+	struct mspi *mspi, am_hal_mspi_device_e device, uint8_t turnaround
+)
+{
+	am_hal_mspi_dev_config_t *config = &mspi->config;
+	if (!mspi->reconfigure && config->eDeviceConfig == device &&
+		config->ui8TurnAround == turnaround)
+		return;
+
+	mspi->reconfigure = false;
+	config->eDeviceConfig = device;
+	config->ui8TurnAround = turnaround;
+	config->bTurnaround = turnaround != 0;
+	am_hal_mspi_disable(mspi->handle);
+	am_hal_mspi_device_configure(mspi->handle, config);
+	am_hal_mspi_enable(mspi->handle);
+}
+
+struct mspi *mspi_get_instance(uint32_t clock)
+{
+	struct mspi *mspi = &mspi_;
+	if (!mspi->handle)
+	{
+		// Start out with plain serial reads and page programs, the flash
+		// driver switches to faster commands once it knows what the chip
+		// supports
+		const am_hal_mspi_dev_config_t config = {
+			.eSpiMode = AM_HAL_MSPI_SPI_MODE_0,
+			.eClockFreq = select_clock(clock),
+			.ui8TurnAround = 0,
+			.eAddrCfg = AM_HAL_MSPI_ADDR_3_BYTE,
+			.eInstrCfg = AM_HAL_MSPI_INSTR_1_BYTE,
+			.eDeviceConfig = AM_HAL_MSPI_FLASH_SERIAL_CE0,
+			.bSeparateIO = true,
+			.bSendInstr = true,
+			.bSendAddr = true,
+			.bTurnaround = false,
+			.ui8ReadInstr = 0x03,
+			.ui8WriteInstr = 0x02,
+			.ui32TCBSize = sizeof(tcb_buffer) / sizeof(tcb_buffer[0]),
+			.pTCB = tcb_buffer,
+			.scramblingStartAddr = 0,
+			.scramblingEndAddr = 0,
+		};
+		mspi->config = config;
+		mspi->data_device = AM_HAL_MSPI_FLASH_SERIAL_CE0;
+		mspi->data_dummy_clocks = 0;
+		mspi->reconfigure = false;
+
+		if (am_hal_mspi_initialize(0, &mspi->handle) != AM_HAL_STATUS_SUCCESS)
+		{
+			mspi->handle = NULL;
+			return NULL;
+		}
+		am_hal_mspi_power_control(mspi->handle, AM_HAL_SYSCTRL_WAKE, false);
+		am_hal_mspi_device_configure(mspi->handle, &mspi->config);
+		am_hal_mspi_enable(mspi->handle);
+		am_hal_mspi_interrupt_clear(
+			mspi->handle, AM_HAL_MSPI_INT_CQUPD | AM_HAL_MSPI_INT_ERR
+		);
+		am_hal_mspi_interrupt_enable(
+			mspi->handle, AM_HAL_MSPI_INT_CQUPD | AM_HAL_MSPI_INT_ERR
+		);
+		// Don't bother enabling pins, sleep is going to disable them anyway
+		mspi_sleep(mspi);
+	}
+	mspi->refcount++;
+	return mspi;
+}
+
+void mspi_deinitialize(struct mspi *mspi)
+{
+	if (mspi->refcount)
+	{
+		if (!--(mspi->refcount))
+		{
+			NVIC_DisableIRQ(MSPI_IRQn);
+			am_hal_mspi_disable(mspi->handle);
+			am_bsp_mspi_pins_disable(AM_HAL_MSPI_FLASH_QUAD_CE0);
+			am_hal_mspi_power_control(
+				mspi->handle, AM_HAL_SYSCTRL_DEEPSLEEP, false
+			);
+			am_hal_mspi_deinitialize(mspi->handle);
+			memset(mspi, 0, sizeof(*mspi));
+		}
+	}
+}
+
+bool mspi_sleep(struct mspi *mspi)
+{
+	// Note that turning off the hardware resets registers, which is why we
+	// request saving the state
+	// Also, spinloop while the device is busy
+	// Implementation based off spi.c
+	NVIC_DisableIRQ(MSPI_IRQn);
+	int status;
+	do
+	{
+		status = am_hal_mspi_power_control(
+			mspi->handle, AM_HAL_SYSCTRL_DEEPSLEEP, true
+		);
+	}
+	while (status == AM_HAL_STATUS_IN_USE);
+
+	// The quad pin set is a superset of the serial one
+	am_bsp_mspi_pins_disable(AM_HAL_MSPI_FLASH_QUAD_CE0);
+	return true;
+}
+
+bool mspi_enable(struct mspi *mspi)
+{
+	// This can fail if there is no saved state, which indicates we've never
+	// gone asleep
+	int status =
+		am_hal_mspi_power_control(mspi->handle, AM_HAL_SYSCTRL_WAKE, true);
+	if (status != AM_HAL_STATUS_SUCCESS)
+	{
+		return false;
+	}
+	am_bsp_mspi_pins_enable(AM_HAL_MSPI_FLASH_QUAD_CE0);
+	NVIC_EnableIRQ(MSPI_IRQn);
+	return true;
+}
+
+// Runs a PIO transfer through a small word-aligned buffer, as the HAL needs
+// one. Bigger transfers are split into pieces, and CE is held between them
+// so the device sees a single command. buffer is only written to when
+// receiving.
+static bool mspi_pio(
+	struct mspi *mspi, am_hal_mspi_dir_e direction, uint8_t command,
+	bool send_address, uint32_t address, bool turnaround, void *buffer,
+	uint32_t size
+)
+{
+	uint32_t words[MSPI_PIO_WORDS];
+	uint8_t *bytes = buffer;
+	bool first = true;
+	do
+	{
+		uint32_t piece = size > sizeof(words) ? sizeof(words) : size;
+		if (direction == AM_HAL_MSPI_TX)
+			memcpy(words, bytes, piece);
+		am_hal_mspi_pio_transfer_t transfer = {
+			.ui32NumBytes = piece,
+			.eDirection = direction,
+			.bSendAddr = first && send_address,
+			.ui32DeviceAddr = address,
+			.bSendInstr = first,
+			.ui16DeviceInstr = command,
+			.bTurnaround = first && turnaround,
+			.bContinue = piece < size,
+			.pui32Buffer = words,
+		};
+		int status = am_hal_mspi_blocking_transfer(
+			mspi->handle, &transfer, MSPI_TIMEOUT
+		);
+		if (status != AM_HAL_STATUS_SUCCESS)
+			return false;
+		if (direction == AM_HAL_MSPI_RX)
+			memcpy(bytes, words, piece);
+		bytes += piece;
+		size -= piece;
+		first = false;
+	}
+	while (size);
+	return true;
+}
+
+static void mspi_dma_callback(void *context, uint32_t status)
+{
+	struct mspi *mspi = context;
+	mspi->dma_status = status;
+	mspi->dma_done = true;
+}
+
+static bool mspi_dma(
+	struct mspi *mspi, am_hal_mspi_dir_e direction, uint32_t address,
+	uint32_t sram_address, uint32_t size
+)
+{
+	am_hal_mspi_dma_transfer_t transfer = {
+		.ui8Priority = 1,
+		.eDirection = direction,
+		.ui32TransferCount = size,
+		.ui32DeviceAddress = address,
+		.ui32SRAMAddress = sram_address,
+		.ui32PauseCondition = 0,
+		.ui32StatusSetClr = 0,
+	};
+	mspi->dma_done = false;
+	// The callback never runs if the transfer wasn't queued, so don't wait
+	// for it
+	int status = am_hal_mspi_nonblocking_transfer(
+		mspi->handle, &transfer, AM_HAL_MSPI_TRANS_DMA, mspi_dma_callback,
+		mspi
+	);
+	if (status != AM_HAL_STATUS_SUCCESS)
+		return false;
+
+	// Sleep until the ISR reports completion. Interrupts are masked while we
+	// check the flag so the completion can't sneak in between the check and
+	// the sleep-- a pending interrupt still wakes the core. Deep sleep would
+	// stop the clock the MSPI runs from, so only use normal sleep.
+	for (;;)
+	{
+		uint32_t state = am_hal_interrupt_master_disable();
+		if (mspi->dma_done)
+		{
+			am_hal_interrupt_master_set(state);
+			break;
+		}
+		am_hal_sysctrl_sleep(AM_HAL_SYSCTRL_SLEEP_NORMAL);
+		am_hal_interrupt_master_set(state);
+	}
+	return mspi->dma_status == AM_HAL_STATUS_SUCCESS;
+}
+
+void mspi_command_read(
+	struct mspi *mspi, uint8_t command, bool send_address, uint32_t address,
+	uint8_t dummy_clocks, uint8_t *buffer, uint32_t size
+)
+{
+	// Commands always go over a single line. The turnaround is only used if
+	// the transfer asks for it, so leave it alone otherwise.
+	mspi_apply(
+		mspi, AM_HAL_MSPI_FLASH_SERIAL_CE0,
+		dummy_clocks ? dummy_clocks : mspi->config.ui8TurnAround
+	);
+	mspi_pio(
+		mspi, AM_HAL_MSPI_RX, command, send_address, address,
+		dummy_clocks != 0, buffer, size
+	);
+}
+
+void mspi_command_write(
+	struct mspi *mspi, uint8_t command, bool send_address, uint32_t address,
+	const uint8_t *buffer, uint32_t size
+)
+{
+	mspi_apply(
+		mspi, AM_HAL_MSPI_FLASH_SERIAL_CE0, mspi->config.ui8TurnAround
+	);
+	mspi_pio(
+		mspi, AM_HAL_MSPI_TX, command, send_address, address, false,
+		(void *)buffer, size
+	);
+}
+
+void mspi_configure_data(
+	struct mspi *mspi, enum mspi_data_width width, uint8_t read_command,
+	uint8_t read_dummy_clocks, uint8_t write_command
+)
+{
+	mspi->data_device = width == MSPI_DATA_WIDTH_4
+		? AM_HAL_MSPI_FLASH_QUAD_CE0_1_1_4
+		: AM_HAL_MSPI_FLASH_SERIAL_CE0;
+	mspi->data_dummy_clocks = read_dummy_clocks;
+	// The DMA commands are part of the device configuration, so make sure the
+	// next transfer applies them
+	mspi->config.ui8ReadInstr = read_command;
+	mspi->config.ui8WriteInstr = write_command;
+	mspi->reconfigure = true;
+}
+
+bool mspi_data_read(
+	struct mspi *mspi, uint32_t address, uint8_t *buffer, uint32_t size
+)
+{
+	mspi_apply(mspi, mspi->data_device, mspi->data_dummy_clocks);
+	while (size)
+	{
+		uint32_t chunk = size > MSPI_MAX_TRANSFER ? MSPI_MAX_TRANSFER : size;
+		if (((uintptr_t)buffer & 0x3) == 0)
+		{
+			if (!mspi_dma(
+					mspi, AM_HAL_MSPI_RX, address, (uint32_t)(uintptr_t)buffer,
+					chunk
+				))
+				return false;
+		}
+		else
+		{
+			if (!mspi_pio(
+					mspi, AM_HAL_MSPI_RX, mspi->config.ui8ReadInstr, true,
+					address, mspi->data_dummy_clocks != 0, buffer, chunk
+				))
+				return false;
+		}
+		address += chunk;
+		buffer += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+bool mspi_data_write(
+	struct mspi *mspi, uint32_t address, const uint8_t *buffer, uint32_t size
+)
+{
+	mspi_apply(mspi, mspi->data_device, mspi->data_dummy_clocks);
+	while (size)
+	{
+		uint32_t chunk = size > MSPI_MAX_TRANSFER ? MSPI_MAX_TRANSFER : size;
+		if (((uintptr_t)buffer & 0x3) == 0)
+		{
+			if (!mspi_dma(
+					mspi, AM_HAL_MSPI_TX, address, (uint32_t)(uintptr_t)buffer,
+					chunk
+				))
+				return false;
+		}
+		else
+		{
+			if (!mspi_pio(
+					mspi, AM_HAL_MSPI_TX, mspi->config.ui8WriteInstr, true,
+					address, false, (void *)buffer, chunk
+				))
+				return false;
+		}
+		address += chunk;
+		buffer += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+// This is a weak symbol, override
+void am_mspi_isr(void)
+{
+	uint32_t status;
+	void *handle = mspi_.handle;
+	am_hal_mspi_interrupt_status_get(handle, &status, false);
+	am_hal_mspi_interrupt_clear(handle, status);
+	am_hal_mspi_interrupt_service(handle, status);
+}
@@ -5,6 +5,7 @@
 // SPDX-FileCopyrightText: Ambiq Micro, Inc., 2023
 
 #include <pdm.h>
+#include <telemetry.h>
 #include <uart.h>
 
 #include <arm_math.h>
@@ -13,8 +14,11 @@
 #include "am_mcu_apollo.h"
 #include "am_util.h"
 
+#include <assert.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 struct pdm
 {
@@ -22,31 +26,166 @@ struct pdm
 	uint32_t g_ui32PDMDataBuffer2[PDM_SIZE];
 	void *PDMHandle;
 	atomic_uint refcount;
+
+	am_hal_pdm_config_t config;
+	uint32_t millihertz;
+	bool awake;
+	// Set by pdm_configure while asleep, applied by pdm_enable
+	bool config_pending;
+
+	// Ping-pong streaming, DMA fills one buffer while the other is handed to
+	// the callback
+	pdm_stream_callback stream_callback;
+	void *stream_context;
+	struct pdm_stream_stats stream_stats;
+	unsigned stream_index;
+	volatile bool streaming;
 };
 
 static struct pdm pdm;
 
 static volatile bool g_bPDMDataReady = false;
 
-am_hal_pdm_config_t g_sPdmConfig = {
-	.eClkDivider = AM_HAL_PDM_MCLKDIV_1,
-	.eLeftGain = AM_HAL_PDM_GAIN_P405DB,
-	.eRightGain = AM_HAL_PDM_GAIN_P405DB,
-	.ui32DecimationRate = 48,
-	.bHighPassEnable = 0,
-	.ui32HighPassCutoff = 0xB,
-	.ePDMClkSpeed = AM_HAL_PDM_CLK_750KHZ,
+// Fixed settings, the rest come from a pdm_config
+static const am_hal_pdm_config_t pdm_base_config = {
 	.bInvertI2SBCLK = 0,
 	.ePDMClkSource = AM_HAL_PDM_INTERNAL_CLK,
 	.bPDMSampleDelay = 0,
 	.bDataPacking = 1,
-	.ePCMChannels = AM_HAL_PDM_CHANNEL_RIGHT,
 	.ui32GainChangeDelay = 1,
 	.bI2SEnable = 0,
 	.bSoftMute = 0,
 	.bLRSwap = 0,
 };
 
+// The PCM sample rate is the PDM clock / (clock divider * 2 * decimation rate)
+struct pdm_clock
+{
+	am_hal_pdm_clkspd_e speed;
+	uint32_t hz;
+};
+
+// Slowest first, so the lowest power clock wins when several are as good
+static const struct pdm_clock pdm_clocks[] = {
+	{AM_HAL_PDM_CLK_187KHZ, 187500},
+	{AM_HAL_PDM_CLK_375KHZ, 375000},
+	{AM_HAL_PDM_CLK_750KHZ, 750000},
+	{AM_HAL_PDM_CLK_1_5MHZ, 1500000},
+	{AM_HAL_PDM_CLK_3MHZ, 3000000},
+	{AM_HAL_PDM_CLK_6MHZ, 6000000},
+	{AM_HAL_PDM_CLK_12MHZ, 12000000},
+};
+
+// Indexed by the divider minus 1
+static const am_hal_pdm_mclkdiv_e pdm_dividers[] = {
+	AM_HAL_PDM_MCLKDIV_1,
+	AM_HAL_PDM_MCLKDIV_2,
+	AM_HAL_PDM_MCLKDIV_3,
+	AM_HAL_PDM_MCLKDIV_4,
+};
+
+static const am_hal_pdm_chset_e pdm_hal_channels[] = {
+	[PDM_CHANNEL_LEFT] = AM_HAL_PDM_CHANNEL_LEFT,
+	[PDM_CHANNEL_RIGHT] = AM_HAL_PDM_CHANNEL_RIGHT,
+	[PDM_CHANNEL_STEREO] = AM_HAL_PDM_CHANNEL_STEREO,
+};
+
+// Less oversampling lets through too much noise, and more only costs PDM
+// clock power (the hardware takes up to 127). 48 is what this library always
+// used
+#define PDM_MIN_DECIMATION 16
+#define PDM_MAX_DECIMATION 48
+
+// Gain settings are 1.5 dB (15 tenths of a dB) apart
+#define PDM_GAIN_STEP 15
+static_assert(
+	AM_HAL_PDM_GAIN_P405DB - AM_HAL_PDM_GAIN_0DB ==
+		PDM_MAX_GAIN / PDM_GAIN_STEP,
+	"PDM gain settings are not contiguous"
+);
+
+static uint64_t pdm_millihertz(
+	uint32_t clock_hz, uint32_t divider, uint32_t decimation
+)
+{
+	const uint64_t denominator = 2 * divider * decimation;
+	return ((uint64_t)clock_hz * 1000 + denominator / 2) / denominator;
+}
+
+// Translates settings to the HAL, returns the sample rate they reach in mHz,
+// or 0 if they are invalid
+static uint32_t pdm_build_config(
+	const struct pdm_config *config, am_hal_pdm_config_t *hal_config
+)
+{
+	if (!config->sample_rate || config->gain > PDM_MAX_GAIN ||
+		config->high_pass_cutoff > PDM_MAX_HIGH_PASS_CUTOFF ||
+		config->channels > PDM_CHANNEL_STEREO)
+	{
+		return 0;
+	}
+
+	const uint64_t target = (uint64_t)config->sample_rate * 1000;
+	const struct pdm_clock *best_clock = NULL;
+	uint32_t best_divider = 0;
+	uint32_t best_decimation = 0;
+	uint64_t best_error = UINT64_MAX;
+	for (size_t i = 0; i < sizeof(pdm_clocks) / sizeof(*pdm_clocks); ++i)
+	{
+		const struct pdm_clock *clock = &pdm_clocks[i];
+		for (uint32_t divider = 1;
+			 divider <= sizeof(pdm_dividers) / sizeof(*pdm_dividers);
+			 ++divider)
+		{
+			const uint64_t denominator = 2 * divider * target;
+			const uint64_t decimation =
+				((uint64_t)clock->hz * 1000 + denominator / 2) / denominator;
+			if (decimation < PDM_MIN_DECIMATION ||
+				decimation > PDM_MAX_DECIMATION)
+			{
+				continue;
+			}
+			const uint64_t achieved =
+				pdm_millihertz(clock->hz, divider, decimation);
+			const uint64_t error =
+				achieved > target ? achieved - target : target - achieved;
+			// More oversampling is quieter, so prefer it when as close
+			if (error < best_error ||
+				(error == best_error && decimation > best_decimation))
+			{
+				best_clock = clock;
+				best_divider = divider;
+				best_decimation = decimation;
+				best_error = error;
+			}
+		}
+	}
+	if (!best_clock)
+		return 0;
+
+	const am_hal_pdm_gain_e gain = AM_HAL_PDM_GAIN_0DB +
+		(config->gain + PDM_GAIN_STEP / 2) / PDM_GAIN_STEP;
+	*hal_config = pdm_base_config;
+	hal_config->ePDMClkSpeed = best_clock->speed;
+	hal_config->eClkDivider = pdm_dividers[best_divider - 1];
+	hal_config->ui32DecimationRate = best_decimation;
+	hal_config->eLeftGain = gain;
+	hal_config->eRightGain = gain;
+	hal_config->bHighPassEnable = config->high_pass;
+	hal_config->ui32HighPassCutoff = config->high_pass_cutoff;
+	hal_config->ePCMChannels = pdm_hal_channels[config->channels];
+	return pdm_millihertz(best_clock->hz, best_divider, best_decimation);
+}
+
+// The PDM must be awake
+static void pdm_apply_config(struct pdm *pdm)
+{
+	am_hal_pdm_disable(pdm->PDMHandle);
+	am_hal_pdm_configure(pdm->PDMHandle, &pdm->config);
+	am_hal_pdm_enable(pdm->PDMHandle);
+	am_hal_pdm_fifo_flush(pdm->PDMHandle);
+}
+
 struct pdm *pdm_get_instance(void)
 {
 	if (!pdm.PDMHandle)
@@ -54,7 +193,8 @@ struct pdm *pdm_get_instance(void)
 		// Initialize, power-up, and configure the PDM.
 		am_hal_pdm_initialize(0, &pdm.PDMHandle);
 		am_hal_pdm_power_control(pdm.PDMHandle, AM_HAL_PDM_POWER_ON, false);
-		am_hal_pdm_configure(pdm.PDMHandle, &g_sPdmConfig);
+		pdm.millihertz = pdm_build_config(&PDM_CONFIG_DEFAULT, &pdm.config);
+		am_hal_pdm_configure(pdm.PDMHandle, &pdm.config);
 		am_hal_pdm_enable(pdm.PDMHandle);
 
 		// Configure the necessary pins.
@@ -77,6 +217,8 @@ struct pdm *pdm_get_instance(void)
 
 bool pdm_sleep(struct pdm *pdm)
 {
+	pdm_stream_stop(pdm);
+
 	// Note that turning off the hardware resets registers, which is why we
 	// request saving the state
 	// Also, spinloop while the device is busy
@@ -93,6 +235,7 @@ bool pdm_sleep(struct pdm *pdm)
 
 	am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_DATA, g_AM_HAL_GPIO_DISABLE);
 	am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_CLK, g_AM_HAL_GPIO_DISABLE);
+	pdm->awake = false;
 	return true;
 }
 
@@ -107,18 +250,51 @@ bool pdm_enable(struct pdm *pdm)
 		return false;
 	}
 
+	// The restored state has the settings from before sleeping
+	if (pdm->config_pending)
+	{
+		pdm_apply_config(pdm);
+		pdm->config_pending = false;
+	}
+	pdm->awake = true;
+
 	am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_DATA, g_AM_BSP_GPIO_MIC_DATA);
 	am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_CLK, g_AM_BSP_GPIO_MIC_CLK);
 	NVIC_EnableIRQ(PDM_IRQn);
 	return true;
 }
 
-void pdm_disable(struct pdm *pdm)
+uint32_t pdm_configure(struct pdm *pdm, const struct pdm_config *config)
+{
+	if (pdm->streaming)
+		return 0;
+
+	am_hal_pdm_config_t hal_config;
+	const uint32_t millihertz = pdm_build_config(config, &hal_config);
+	if (!millihertz)
+		return 0;
+
+	pdm->config = hal_config;
+	pdm->millihertz = millihertz;
+	if (pdm->awake)
+		pdm_apply_config(pdm);
+	else
+		pdm->config_pending = true;
+	return millihertz;
+}
+
+uint32_t pdm_get_sample_rate(const struct pdm *pdm)
+{
+	return pdm->millihertz;
+}
+
+void pdm_deinitialize(struct pdm *pdm)
 {
 	if (pdm->refcount)
 	{
 		if (!--(pdm->refcount))
 		{
+			pdm_stream_stop(pdm);
 			NVIC_DisableIRQ(PDM_IRQn);
 			am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_DATA, g_AM_HAL_GPIO_DISABLE);
 			am_hal_gpio_pinconfig(AM_BSP_GPIO_MIC_CLK, g_AM_HAL_GPIO_DISABLE);
@@ -161,6 +337,88 @@ void pdm_data_get(struct pdm *pdm, uint32_t *g_ui32PDMDataBuffer)
 	am_hal_pdm_dma_start(pdm->PDMHandle, &sTransfer);
 }
 
+static uint32_t *pdm_stream_buffer(struct pdm *pdm, unsigned index)
+{
+	return index ? pdm->g_ui32PDMDataBuffer2 : pdm->g_ui32PDMDataBuffer1;
+}
+
+// Points DMA at one of the buffers. The FIFO is not flushed, so samples that
+// arrive while switching buffers are kept
+static void pdm_stream_arm(struct pdm *pdm, unsigned index)
+{
+	am_hal_pdm_transfer_t transfer = {
+		.ui32TargetAddr = (uintptr_t)pdm_stream_buffer(pdm, index),
+		.ui32TotalCount = PDM_BYTES,
+	};
+	pdm->stream_index = index;
+	// Clear the completion and error flags of the last transfer
+	PDM->DMASTAT = 0;
+	am_hal_pdm_dma_start(pdm->PDMHandle, &transfer);
+}
+
+static void pdm_stream_handle(struct pdm *pdm, uint32_t status)
+{
+	if (status & AM_HAL_PDM_INT_OVF)
+		pdm->stream_stats.fifo_overflows += 1;
+
+	if (status & AM_HAL_PDM_INT_DERR)
+	{
+		// Start over on the same buffer, what was in it is lost
+		pdm->stream_stats.dma_errors += 1;
+		pdm_stream_arm(pdm, pdm->stream_index);
+	}
+	else if (status & AM_HAL_PDM_INT_DCMP)
+	{
+		// Switch buffers first, the FIFO holds new samples meanwhile
+		const unsigned full = pdm->stream_index;
+		pdm_stream_arm(pdm, !full);
+		pdm->stream_stats.buffers += 1;
+		pdm->stream_callback(
+			pdm->stream_context,
+			(const int16_t *)pdm_stream_buffer(pdm, full),
+			PDM_BYTES / sizeof(int16_t)
+		);
+	}
+}
+
+bool pdm_stream_start(
+	struct pdm *pdm, pdm_stream_callback callback, void *context
+)
+{
+	if (pdm->streaming || !callback)
+		return false;
+
+	pdm->stream_callback = callback;
+	pdm->stream_context = context;
+	memset(&pdm->stream_stats, 0, sizeof(pdm->stream_stats));
+
+	// Drop the flags of any transfer started by pdm_data_get
+	am_hal_pdm_interrupt_clear(
+		pdm->PDMHandle, AM_HAL_PDM_INT_DCMP | AM_HAL_PDM_INT_DERR
+	);
+	pdm->streaming = true;
+	pdm_stream_arm(pdm, 0);
+	return true;
+}
+
+void pdm_stream_stop(struct pdm *pdm)
+{
+	if (!pdm->streaming)
+		return;
+
+	pdm->streaming = false;
+	PDM->DMACFG_b.DMAEN = PDM_DMACFG_DMAEN_DIS;
+}
+
+void pdm_stream_get_stats(
+	const struct pdm *pdm, struct pdm_stream_stats *stats
+)
+{
+	uint32_t state = am_hal_interrupt_master_disable();
+	*stats = pdm->stream_stats;
+	am_hal_interrupt_master_set(state);
+}
+
 void am_pdm0_isr(void)
 {
 	uint32_t ui32Status;
@@ -169,7 +427,11 @@ void am_pdm0_isr(void)
 	am_hal_pdm_interrupt_status_get(pdm.PDMHandle, &ui32Status, true);
 	am_hal_pdm_interrupt_clear(pdm.PDMHandle, ui32Status);
 
-	if (ui32Status & AM_HAL_PDM_INT_DCMP)
+	if (pdm.streaming)
+	{
+		pdm_stream_handle(&pdm, ui32Status);
+	}
+	else if (ui32Status & AM_HAL_PDM_INT_DCMP)
 	{
 		g_bPDMDataReady = true;
 	}
@@ -177,16 +439,30 @@ void am_pdm0_isr(void)
 
 void pcm_print(struct uart *uart, uint32_t *g_ui32PDMDataBuffer)
 {
-	int16_t *pi16PDMData = (int16_t *)g_ui32PDMDataBuffer;
+	// Hand the UART as much as its TX buffer takes at once, instead of a
+	// sample at a time
+	uart_write_all(uart, (const unsigned char *)g_ui32PDMDataBuffer, PDM_BYTES);
+}
 
-	// Convert the PDM samples to floats.
-	for (uint32_t i = 0; i < PDM_SIZE; i++)
+// Payload, channel ID and CRC, one COBS code byte per 254 bytes plus the
+// first, and the terminating zero
+static_assert(
+	PDM_TELEMETRY_FRAME_BYTES + 5 + (PDM_TELEMETRY_FRAME_BYTES + 5) / 254 + 2 <=
+		TELEMETRY_BUFFER_SIZE,
+	"PDM_TELEMETRY_FRAME_BYTES frames don't fit TELEMETRY_BUFFER_SIZE"
+);
+
+void pcm_send(struct telemetry *telemetry, const void *samples, size_t size)
+{
+	const uint8_t *bytes = samples;
+	while (size)
 	{
-		uint16_t data = pi16PDMData[i];
-		for (size_t sent = 0; sent != 2;)
-		{
-			sent += uart_write(uart, (uint8_t *)&data + sent, 2 - sent);
-		}
+		const size_t chunk = size < PDM_TELEMETRY_FRAME_BYTES ?
+			size :
+			PDM_TELEMETRY_FRAME_BYTES;
+		telemetry_send(telemetry, PDM_TELEMETRY_CHANNEL, bytes, chunk);
+		bytes += chunk;
+		size -= chunk;
 	}
 }
 
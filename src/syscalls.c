@@ -8,7 +8,10 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <errno.h>
 #undef errno
@@ -92,7 +95,7 @@ static int syscalls_fstat(void *sys, int fd, struct stat *st)
 	return base->fstat(base, fd, st);
 }
 
-static int syscalls_stat(void *sys, char *path, struct stat *st)
+static int syscalls_stat(void *sys, const char *path, struct stat *st)
 {
 	struct syscalls_base *base = sys;
 	if (!base || !base->stat)
@@ -103,14 +106,96 @@ static int syscalls_stat(void *sys, char *path, struct stat *st)
 	return base->stat(base, path, st);
 }
 
+struct syscalls_mount
+{
+	char prefix[SYSCALLS_MAX_PREFIX + 1];
+	size_t length;
+	struct syscalls_base *device;
+};
+
+// Every open file, with the device and the device's own handle for it. Free
+// entries are chained through next_free.
+struct syscalls_file
+{
+	struct syscalls_base *device;
+	int file;
+	int next_free;
+};
+
 struct syscalls_devices
 {
-	struct syscalls_base *stdio[3];
 	struct syscalls_base *rtc;
-	struct syscalls_base *fs;
+	struct syscalls_mount mounts[SYSCALLS_MAX_MOUNTS];
+	struct syscalls_file files[SYSCALLS_MAX_FILES];
+	int free_file;
+	bool files_initialized;
 };
 
 static struct syscalls_devices devices;
+
+// stdin, stdout, and stderr are always the first three entries
+static void syscalls_files_init(void)
+{
+	if (devices.files_initialized)
+		return;
+	for (int i = 0; i < SYSCALLS_MAX_FILES; ++i)
+	{
+		devices.files[i].device = NULL;
+		devices.files[i].file = i;
+		devices.files[i].next_free = i + 1 < SYSCALLS_MAX_FILES ? i + 1 : -1;
+	}
+	devices.free_file = 3;
+	devices.files_initialized = true;
+}
+
+static int syscalls_file_allocate(void)
+{
+	syscalls_files_init();
+	int fd = devices.free_file;
+	if (fd >= 0)
+		devices.free_file = devices.files[fd].next_free;
+	return fd;
+}
+
+static void syscalls_file_free(int fd)
+{
+	devices.files[fd].device = NULL;
+	devices.files[fd].next_free = devices.free_file;
+	devices.free_file = fd;
+}
+
+// Gets an open file. Invalid descriptors get an entry with no device, which
+// the dispatch functions report as EBADF.
+static const struct syscalls_file *syscalls_get_file(int fd)
+{
+	static const struct syscalls_file closed = {
+		.device = NULL,
+		.file = -1,
+		.next_free = -1,
+	};
+	if (fd < 0 || fd >= SYSCALLS_MAX_FILES)
+		return &closed;
+	return &devices.files[fd];
+}
+
+// Finds the mount the path belongs to, and where the path within it starts
+static struct syscalls_mount *
+syscalls_find_mount(const char *path, const char **subpath)
+{
+	for (size_t i = 0; i < SYSCALLS_MAX_MOUNTS; ++i)
+	{
+		struct syscalls_mount *mount = &devices.mounts[i];
+		if (mount->device &&
+			strncmp(path, mount->prefix, mount->length) == 0 &&
+			path[mount->length] == '/')
+		{
+			*subpath = path + mount->length;
+			return mount;
+		}
+	}
+	return NULL;
+}
+
 void syscalls_register_rtc(void *device)
 {
 	devices.rtc = (struct syscalls_base *)device;
@@ -118,22 +203,64 @@ void syscalls_register_rtc(void *device)
 
 void syscalls_register_stdin(void *device)
 {
-	devices.stdio[0] = (struct syscalls_base *)device;
+	syscalls_files_init();
+	devices.files[0].device = (struct syscalls_base *)device;
 }
 
 void syscalls_register_stdout(void *device)
 {
-	devices.stdio[1] = (struct syscalls_base *)device;
+	syscalls_files_init();
+	devices.files[1].device = (struct syscalls_base *)device;
 }
 
 void syscalls_register_stderr(void *device)
 {
-	devices.stdio[2] = (struct syscalls_base *)device;
+	syscalls_files_init();
+	devices.files[2].device = (struct syscalls_base *)device;
 }
 
-void syscalls_register_fs(void *device)
+bool syscalls_register_mount(const char *prefix, void *device)
 {
-	devices.fs = (struct syscalls_base *)device;
+	size_t length = strlen(prefix);
+	// Let "fs:/" mean the same as "fs:"
+	if (length && prefix[length - 1] == '/')
+		length -= 1;
+	if (!length || length > SYSCALLS_MAX_PREFIX)
+		return false;
+
+	struct syscalls_mount *empty = NULL;
+	for (size_t i = 0; i < SYSCALLS_MAX_MOUNTS; ++i)
+	{
+		struct syscalls_mount *mount = &devices.mounts[i];
+		if (!mount->device)
+		{
+			if (!empty)
+				empty = mount;
+		}
+		else if (mount->length == length &&
+			strncmp(mount->prefix, prefix, length) == 0)
+		{
+			// Already mounted there, unregister that first
+			return false;
+		}
+	}
+	if (!empty)
+		return false;
+
+	memcpy(empty->prefix, prefix, length);
+	empty->prefix[length] = '\0';
+	empty->length = length;
+	empty->device = (struct syscalls_base *)device;
+	return true;
+}
+
+void syscalls_unregister_mount(void *device)
+{
+	for (size_t i = 0; i < SYSCALLS_MAX_MOUNTS; ++i)
+	{
+		if (devices.mounts[i].device == device)
+			devices.mounts[i].device = NULL;
+	}
 }
 
 // Syscalls
@@ -162,62 +289,48 @@ _gettimeofday(struct timeval *ptimeval, void *ptimezone)
 
 __attribute__((used)) int _open(const char *name, int flags, int mode)
 {
-	// FIXME check if mounted?
-	if (devices.fs && strncmp(name, "fs:/", 4) == 0)
+	const char *path;
+	struct syscalls_mount *mount = syscalls_find_mount(name, &path);
+	if (!mount)
 	{
-		int result = syscalls_open(devices.fs, name + 3, flags, mode);
-		if (result >= 0)
-		{
-			return result + 3;
-		}
-		return result;
+		errno = ENXIO;
+		return -1;
 	}
-	errno = ENXIO;
-	return -1;
-}
 
-__attribute__((used)) int _read(int file, char *ptr, int len)
-{
-	if (file < 3)
+	int fd = syscalls_file_allocate();
+	if (fd < 0)
 	{
-		return syscalls_read(devices.stdio[file], file, ptr, len);
+		errno = ENFILE;
+		return -1;
 	}
-	if (file >= 3)
+
+	int result = syscalls_open(mount->device, path, flags, mode);
+	if (result < 0)
 	{
-		return syscalls_read(devices.fs, file - 3, ptr, len);
+		syscalls_file_free(fd);
+		return result;
 	}
-	errno = ENOSYS;
-	return -1;
+	devices.files[fd].device = mount->device;
+	devices.files[fd].file = result;
+	return fd;
+}
+
+__attribute__((used)) int _read(int file, char *ptr, int len)
+{
+	const struct syscalls_file *entry = syscalls_get_file(file);
+	return syscalls_read(entry->device, entry->file, ptr, len);
 }
 
 __attribute__((used)) int _write(int file, char *ptr, int len)
 {
-	// stdin, stdout, stderr
-	if (file < 3)
-	{
-		return syscalls_write(devices.stdio[file], file, ptr, len);
-	}
-	else if (file >= 3)
-	{
-		return syscalls_write(devices.fs, file - 3, ptr, len);
-	}
-	errno = ENOSYS;
-	return -1;
+	const struct syscalls_file *entry = syscalls_get_file(file);
+	return syscalls_write(entry->device, entry->file, ptr, len);
 }
 
 __attribute__((used)) int _lseek(int file, int ptr, int dir)
 {
-	if (file < 3)
-	{
-		return syscalls_lseek(devices.stdio[file], file, ptr, dir);
-		;
-	}
-	else if (file >= 3)
-	{
-		return syscalls_lseek(devices.fs, file - 3, ptr, dir);
-	}
-	errno = ENOSYS;
-	return -1;
+	const struct syscalls_file *entry = syscalls_get_file(file);
+	return syscalls_lseek(entry->device, entry->file, ptr, dir);
 }
 
 __attribute__((used)) int _close(int file)
@@ -227,12 +340,11 @@ __attribute__((used)) int _close(int file)
 		errno = EINVAL;
 		return -1;
 	}
-	else if (file >= 3)
-	{
-		return syscalls_close(devices.fs, file - 3);
-	}
-	errno = ENOSYS;
-	return -1;
+	const struct syscalls_file *entry = syscalls_get_file(file);
+	int result = syscalls_close(entry->device, entry->file);
+	if (result >= 0)
+		syscalls_file_free(file);
+	return result;
 }
 
 __attribute__((used)) int _kill(int pid, int sig)
@@ -260,22 +372,18 @@ __attribute__((used)) int _isatty(int file)
 
 __attribute__((used)) int _fstat(int file, struct stat *st)
 {
-	if (file < 3)
-	{
-		return syscalls_fstat(devices.stdio[file], file, st);
-	}
-	else
-	{
-		return syscalls_fstat(devices.fs, file - 3, st);
-	}
+	const struct syscalls_file *entry = syscalls_get_file(file);
+	return syscalls_fstat(entry->device, entry->file, st);
 }
 
 __attribute__((used)) int _stat(char *filename, struct stat *st)
 {
-	if (devices.fs && strncmp(filename, "fs:/", 4) == 0)
+	const char *path;
+	struct syscalls_mount *mount = syscalls_find_mount(filename, &path);
+	if (!mount)
 	{
-		return syscalls_stat(devices.fs, filename + 3, st);
+		errno = ENOENT;
+		return -1;
 	}
-	errno = ENOENT;
-	return -1;
+	return syscalls_stat(mount->device, path, st);
 }
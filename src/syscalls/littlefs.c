@@ -8,6 +8,8 @@
 
 #include <fcntl.h>
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <errno.h>
@@ -16,27 +18,39 @@ extern int errno;
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(*array))
 
+#ifndef SYSCALLS_LITTLEFS_MAX_FILES
+/** Number of files that can be open at once, across all littlefs mounts. */
+#define SYSCALLS_LITTLEFS_MAX_FILES 10
+#endif
+
 struct syscalls_littlefs
 {
 	struct syscalls_base base;
 	struct asimple_littlefs *fs;
-	struct lfs_file files[10];
-	struct lfs_file *active_files[10];
+	// Files open through this mount, which keep it from being unmounted
+	int open_files;
+};
+
+// Open files are shared by every mount. Each has its own cache, so littlefs
+// doesn't allocate on open. Free entries are chained through next_free.
+struct syscalls_littlefs_file
+{
+	struct lfs_file file;
+	struct lfs_file_config config;
+	int next_free;
+	uint8_t buffer[ASIMPLE_LITTLEFS_MAX_CACHE_SIZE];
 };
 
+static struct syscalls_littlefs_file files[SYSCALLS_LITTLEFS_MAX_FILES];
+static int free_file = -1;
+static struct syscalls_littlefs mounts[SYSCALLS_MAX_MOUNTS];
+
 int littlefs_open_(void *context, const char *name, int flags, int mode)
 {
 	(void)mode; // We don't use mode as we don't have permissions
 	struct syscalls_littlefs *fs = (struct syscalls_littlefs *)context;
-	size_t max = ARRAY_SIZE(fs->files);
-	size_t i;
-	for (i = 0; i < max; ++i)
-	{
-		if (fs->active_files[i] == NULL)
-			break;
-	}
-
-	if (i >= max)
+	int i = free_file;
+	if (i < 0)
 	{
 		errno = ENFILE;
 		return -1;
@@ -59,7 +73,13 @@ int littlefs_open_(void *context, const char *name, int flags, int mode)
 	if (O_CREAT & flags)
 		lfs_flags |= LFS_O_CREAT;
 
-	int result = lfs_file_open(&fs->fs->lfs, &fs->files[i], name, lfs_flags);
+	const struct lfs_file_config config = {
+		.buffer = files[i].buffer,
+	};
+	files[i].config = config;
+	int result = lfs_file_opencfg(
+		&fs->fs->lfs, &files[i].file, name, lfs_flags, &files[i].config
+	);
 	if (result < 0)
 	{
 		// FIXME convert into errno
@@ -67,14 +87,15 @@ int littlefs_open_(void *context, const char *name, int flags, int mode)
 		return -1;
 	}
 
-	fs->active_files[i] = &fs->files[i];
+	free_file = files[i].next_free;
+	fs->open_files += 1;
 	return i;
 }
 
 int littlefs_read_(void *context, int file, char *ptr, int len)
 {
 	struct syscalls_littlefs *fs = (struct syscalls_littlefs *)context;
-	int result = lfs_file_read(&fs->fs->lfs, fs->active_files[file], ptr, len);
+	int result = lfs_file_read(&fs->fs->lfs, &files[file].file, ptr, len);
 	if (result < 0)
 	{
 		// FIXME convert into errno
@@ -87,7 +108,7 @@ int littlefs_read_(void *context, int file, char *ptr, int len)
 int littlefs_write_(void *context, int file, char *ptr, int len)
 {
 	struct syscalls_littlefs *fs = (struct syscalls_littlefs *)context;
-	int result = lfs_file_write(&fs->fs->lfs, fs->active_files[file], ptr, len);
+	int result = lfs_file_write(&fs->fs->lfs, &files[file].file, ptr, len);
 	if (result < 0)
 	{
 		// FIXME convert into errno
@@ -113,8 +134,7 @@ int littlefs_lseek_(void *context, int file, int ptr, int dir)
 		lfs_dir = LFS_SEEK_END;
 		break;
 	}
-	int result =
-		lfs_file_seek(&fs->fs->lfs, fs->active_files[file], ptr, lfs_dir);
+	int result = lfs_file_seek(&fs->fs->lfs, &files[file].file, ptr, lfs_dir);
 	if (result < 0)
 	{
 		// FIXME convert into errno
@@ -127,12 +147,8 @@ int littlefs_lseek_(void *context, int file, int ptr, int dir)
 int littlefs_close_(void *context, int file)
 {
 	struct syscalls_littlefs *fs = (struct syscalls_littlefs *)context;
-	if (!fs->active_files[file])
-	{
-		errno = EBADF;
-		return -1;
-	}
-	int result = lfs_file_close(&fs->fs->lfs, fs->active_files[file]);
+	// The syscalls layer only hands us files it got from our open
+	int result = lfs_file_close(&fs->fs->lfs, &files[file].file);
 	// FIXME what happens in the case of an error??????????????
 
 	if (result < 0)
@@ -141,7 +157,9 @@ int littlefs_close_(void *context, int file)
 		errno = result;
 		return -1;
 	}
-	fs->active_files[file] = NULL;
+	files[file].next_free = free_file;
+	free_file = file;
+	fs->open_files -= 1;
 	return result;
 }
 
@@ -185,19 +203,71 @@ littlefs_stat_(void *context, const char *filename, struct stat *stat)
 	return 0;
 }
 
-static struct syscalls_littlefs fs = {
-	.base = {
-		.open = littlefs_open_,
-		.close = littlefs_close_,
-		.read = littlefs_read_,
-		.write = littlefs_write_,
-		.lseek = littlefs_lseek_,
-		.stat = littlefs_stat_,
-	},
+static const struct syscalls_base littlefs_base = {
+	.open = littlefs_open_,
+	.close = littlefs_close_,
+	.read = littlefs_read_,
+	.write = littlefs_write_,
+	.lseek = littlefs_lseek_,
+	.stat = littlefs_stat_,
 };
 
-void syscalls_littlefs_init(struct asimple_littlefs *fs_)
+bool syscalls_littlefs_mount(const char *prefix, struct asimple_littlefs *fs)
+{
+	// Chain the file pool on first use
+	static bool initialized = false;
+	if (!initialized)
+	{
+		for (int i = 0; i < SYSCALLS_LITTLEFS_MAX_FILES; ++i)
+			files[i].next_free =
+				i + 1 < SYSCALLS_LITTLEFS_MAX_FILES ? i + 1 : -1;
+		free_file = 0;
+		initialized = true;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(mounts); ++i)
+	{
+		struct syscalls_littlefs *mount = &mounts[i];
+		if (mount->fs)
+			continue;
+		mount->base = littlefs_base;
+		mount->fs = fs;
+		mount->open_files = 0;
+		if (!syscalls_register_mount(prefix, mount))
+		{
+			mount->fs = NULL;
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool syscalls_littlefs_unmount(struct asimple_littlefs *fs)
+{
+	// Open files would be left pointing at a mount that's gone, so refuse
+	// before unregistering anything
+	for (size_t i = 0; i < ARRAY_SIZE(mounts); ++i)
+	{
+		if (mounts[i].fs == fs && mounts[i].open_files)
+		{
+			errno = EBUSY;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(mounts); ++i)
+	{
+		if (mounts[i].fs == fs)
+		{
+			syscalls_unregister_mount(&mounts[i]);
+			mounts[i].fs = NULL;
+		}
+	}
+	return true;
+}
+
+void syscalls_littlefs_init(struct asimple_littlefs *fs)
 {
-	fs.fs = fs_;
-	syscalls_register_fs(&fs);
+	syscalls_littlefs_mount("fs:", fs);
 }
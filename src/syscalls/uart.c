@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: Apache-2.0
 // SPDX-FileCopyrightText: Gabriel Marcano, 2023
 
+#include <syscalls.h>
 #include <syscalls_internal.h>
 #include <uart.h>
 
@@ -17,20 +18,45 @@ struct syscalls_uart
 {
 	struct syscalls_base base;
 	struct uart *uart;
+	enum syscalls_uart_sync_mode mode;
+	enum syscalls_uart_full_policy policy;
+	struct syscalls_uart_stats stats;
 };
 
 static int uart_write_(void *context, int file, char *ptr, int len)
 {
-	(void)file;
 	struct syscalls_uart *uart = (struct syscalls_uart *)context;
-	if (!uart && !uart->uart)
+	if (!uart || !uart->uart)
 	{
 		errno = ENXIO;
 		return -1;
 	}
-	int result = uart_write(uart->uart, (unsigned char *)ptr, len);
-	uart_sync(uart->uart);
-	return result;
+
+	const unsigned char *data = (const unsigned char *)ptr;
+	size_t size = len;
+	size_t written = uart_write(uart->uart, data, size);
+	if (written < size)
+	{
+		if (uart->policy == SYSCALLS_UART_FULL_DROP)
+		{
+			uart->stats.dropped += size - written;
+		}
+		else
+		{
+			uart->stats.blocked += size - written;
+			uart->stats.blocks += 1;
+			uart_write_all(uart->uart, data + written, size - written);
+			written = size;
+		}
+	}
+	uart->stats.written += written;
+
+	if (uart->mode == SYSCALLS_UART_SYNC_ALL ||
+		(uart->mode == SYSCALLS_UART_SYNC_STDERR && file == 2))
+		uart_sync(uart->uart);
+	// Dropped bytes are reported as written, as stdio would otherwise retry
+	// them
+	return len;
 }
 
 static int uart_read_(void *context, int file, char *ptr, int len)
@@ -43,26 +69,22 @@ static int uart_read_(void *context, int file, char *ptr, int len)
 
 	(void)file;
 	struct syscalls_uart *uart = (struct syscalls_uart *)context;
-	if (!uart && !uart->uart)
+	if (!uart || !uart->uart)
 	{
 		errno = ENXIO;
 		return -1;
 	}
-	int read = 0;
-	// while(read < len)
-	while (!read)
-	{
-		read += uart_read(uart->uart, (unsigned char *)ptr, len - read);
-		// FIXME sleep if interrupts are enabled?
-	}
-	return read;
+	// Sleeps until at least some data arrives
+	return uart_read_timeout(
+		uart->uart, (unsigned char *)ptr, len, UART_TIMEOUT_FOREVER
+	);
 }
 
 static int uart_fstat_(void *context, int file, struct stat *stat)
 {
 	(void)file;
 	struct syscalls_uart *uart = (struct syscalls_uart *)context;
-	if (!uart && !uart->uart)
+	if (!uart || !uart->uart)
 	{
 		errno = EBADF;
 		return -1;
@@ -77,8 +99,10 @@ static int uart_fstat_(void *context, int file, struct stat *stat)
 		.st_gid = 0,
 		.st_rdev = 1, // FIXME
 		.st_size = 0,
-		.st_blksize = 32, // FIXME confirm with datasheet what the FIFO depth is
-		.st_blocks = 1024 / 32, // FIXME base this on the actual TX/RX size
+		// The TX FIFO is 32 bytes deep, and the TX buffer holds this many of
+		// those
+		.st_blksize = 32,
+		.st_blocks = (uart_tx_buffer_size(uart->uart) + 31) / 32,
 		.st_atim = {0},         // FIXME
 		.st_mtim = {0},         // FIXME
 		.st_ctim = {0},         // FIXME
@@ -96,6 +120,8 @@ static struct syscalls_uart uart = {
 		.lseek = NULL,
 		.fstat = uart_fstat_,
 	},
+	.mode = SYSCALLS_UART_SYNC_ALL,
+	.policy = SYSCALLS_UART_FULL_BLOCK,
 };
 
 void syscalls_uart_init(struct uart *uart_)
@@ -105,3 +131,22 @@ void syscalls_uart_init(struct uart *uart_)
 	syscalls_register_stdout(&uart);
 	syscalls_register_stderr(&uart);
 }
+
+void syscalls_uart_configure(
+	enum syscalls_uart_sync_mode mode, enum syscalls_uart_full_policy policy
+)
+{
+	uart.mode = mode;
+	uart.policy = policy;
+}
+
+void syscalls_uart_flush(void)
+{
+	if (uart.uart)
+		uart_sync(uart.uart);
+}
+
+void syscalls_uart_get_stats(struct syscalls_uart_stats *stats)
+{
+	*stats = uart.stats;
+}
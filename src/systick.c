@@ -69,9 +69,11 @@ void SysTick_Handler(void)
 
 uint64_t systick_jiffies(void)
 {
-	am_hal_interrupt_master_disable();
+	// Restore the previous state instead of enabling interrupts, as this may
+	// be called with interrupts already masked, e.g. by BINLOG
+	uint32_t state = am_hal_interrupt_master_disable();
 	uint64_t result = jiffies;
-	am_hal_interrupt_master_enable();
+	am_hal_interrupt_master_set(state);
 	return result;
 }
 
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <crc32.h>
+#include <telemetry.h>
+#include <uart.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A COBS block is a code byte followed by up to 254 non-zero bytes
+#define TELEMETRY_MAX_BLOCK 255
+
+static_assert(
+	TELEMETRY_BUFFER_SIZE > TELEMETRY_MAX_BLOCK,
+	"TELEMETRY_BUFFER_SIZE can't hold a COBS block"
+);
+
+static void telemetry_flush(struct telemetry *telemetry)
+{
+	telemetry->waits +=
+		uart_write_all(telemetry->uart, telemetry->buffer, telemetry->length);
+	telemetry->length = 0;
+}
+
+// Starts a new COBS block, making sure the whole block fits in the buffer
+static void telemetry_begin_block(struct telemetry *telemetry)
+{
+	if (telemetry->length + TELEMETRY_MAX_BLOCK > TELEMETRY_BUFFER_SIZE)
+		telemetry_flush(telemetry);
+	telemetry->code_index = telemetry->length++;
+	telemetry->code = 1;
+}
+
+static void telemetry_end_block(struct telemetry *telemetry)
+{
+	telemetry->buffer[telemetry->code_index] = telemetry->code;
+}
+
+static void
+telemetry_encode(struct telemetry *telemetry, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (bytes[i])
+		{
+			telemetry->buffer[telemetry->length++] = bytes[i];
+			telemetry->code += 1;
+			if (telemetry->code != 0xFF)
+				continue;
+		}
+		// Either a zero, which the code byte stands in for, or a full block
+		telemetry_end_block(telemetry);
+		telemetry_begin_block(telemetry);
+	}
+}
+
+void telemetry_init(struct telemetry *telemetry, struct uart *uart)
+{
+	telemetry->uart = uart;
+	telemetry->frames = 0;
+	telemetry->waits = 0;
+	telemetry->length = 0;
+	telemetry->code_index = 0;
+	telemetry->code = 0;
+}
+
+void telemetry_send(
+	struct telemetry *telemetry,
+	uint8_t channel,
+	const void *data,
+	size_t size
+)
+{
+	uint32_t crc = crc32_update(0, &channel, 1);
+	crc = crc32_update(crc, data, size);
+	const uint8_t trailer[4] = {crc, crc >> 8, crc >> 16, crc >> 24};
+
+	telemetry_begin_block(telemetry);
+	telemetry_encode(telemetry, &channel, 1);
+	telemetry_encode(telemetry, data, size);
+	telemetry_encode(telemetry, trailer, sizeof(trailer));
+	telemetry_end_block(telemetry);
+	telemetry->buffer[telemetry->length++] = 0;
+	telemetry_flush(telemetry);
+	telemetry->frames += 1;
+}
+
+bool telemetry_set_baud_rate(
+	struct telemetry *telemetry, unsigned int baud_rate
+)
+{
+	return uart_set_baud_rate(telemetry->uart, baud_rate);
+}
+
+void telemetry_get_stats(
+	const struct telemetry *telemetry, struct telemetry_stats *stats
+)
+{
+	stats->frames = telemetry->frames;
+	stats->waits = telemetry->waits;
+}
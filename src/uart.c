@@ -5,10 +5,11 @@
 #include "am_mcu_apollo.h"
 #include "am_util.h"
 
+#include <systick.h>
 #include <uart.h>
 
-#include <assert.h>
 #include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 
 /** UART structure. */
@@ -16,10 +17,24 @@ struct uart
 {
 	void *handle;
 	int instance;
-	// FIXME do we want the buffer size to be fixed?
-	uint8_t tx_buffer[1024];
-	// FIXME does RX work?
-	uint8_t rx_buffer[1024];
+	uint8_t *tx_buffer;
+	size_t tx_size;
+	// Filled by the ISR, rx_head is only written by the ISR and rx_tail only
+	// by readers. One byte is always left empty to tell full from empty.
+	uint8_t *rx_buffer;
+	size_t rx_size;
+	// Whether we allocated the buffers, and need to free them
+	bool tx_allocated;
+	bool rx_allocated;
+	struct uart_config config;
+	struct uart_pins pins;
+	// Counted by the ISR
+	struct uart_error_stats errors;
+	atomic_uint rx_head;
+	atomic_uint rx_tail;
+	// Set by the ISR when the RX buffer fills up, it then stops taking data
+	// out of the FIFO until there is room again
+	atomic_bool rx_paused;
 	atomic_uint refcount;
 };
 
@@ -43,42 +58,198 @@ static void error_handler(uint32_t error)
 
 static struct uart uarts[2];
 
-struct uart *uart_get_instance(enum uart_instance instance)
+#define UART_NO_PIN {-1, NULL}
+
+// Pins each instance starts with, UART0 is the one the board routes to its
+// USB serial converter
+static const struct uart_pins default_pins[2] = {
+	{
+		.tx = {AM_BSP_GPIO_COM_UART_TX, &g_AM_BSP_GPIO_COM_UART_TX},
+		.rx = {AM_BSP_GPIO_COM_UART_RX, &g_AM_BSP_GPIO_COM_UART_RX},
+		.rts = UART_NO_PIN,
+		.cts = UART_NO_PIN,
+	},
+	{
+#ifdef AM_BSP_GPIO_UART1_TX
+		.tx = {AM_BSP_GPIO_UART1_TX, &g_AM_BSP_GPIO_UART1_TX},
+		.rx = {AM_BSP_GPIO_UART1_RX, &g_AM_BSP_GPIO_UART1_RX},
+#else
+		.tx = UART_NO_PIN,
+		.rx = UART_NO_PIN,
+#endif
+		.rts = UART_NO_PIN,
+		.cts = UART_NO_PIN,
+	},
+};
+
+static void uart_pin_config(const struct uart_pin *pin, bool enable)
+{
+	if (pin->pin >= 0)
+		am_hal_gpio_pinconfig(
+			pin->pin, enable ? *pin->config : g_AM_HAL_GPIO_DISABLE
+		);
+}
+
+static void uart_pins_config(const struct uart_pins *pins, bool enable)
+{
+	uart_pin_config(&pins->tx, enable);
+	uart_pin_config(&pins->rx, enable);
+	uart_pin_config(&pins->rts, enable);
+	uart_pin_config(&pins->cts, enable);
+}
+
+// Standard UART settings: 115200-8-N-1, FIFOs interrupting at half-full
+static const struct uart_config default_config = {
+	.baud_rate = 115200,
+	.parity = UART_PARITY_NONE,
+	.two_stop_bits = false,
+	.flow_control = UART_FLOW_CONTROL_NONE,
+	.tx_fifo_level = UART_FIFO_1_2,
+	.rx_fifo_level = UART_FIFO_1_2,
+};
+
+static const uint32_t parities[] = {
+	[UART_PARITY_NONE] = AM_HAL_UART_PARITY_NONE,
+	[UART_PARITY_ODD] = AM_HAL_UART_PARITY_ODD,
+	[UART_PARITY_EVEN] = AM_HAL_UART_PARITY_EVEN,
+};
+
+static const uint32_t flow_controls[] = {
+	[UART_FLOW_CONTROL_NONE] = AM_HAL_UART_FLOW_CTRL_NONE,
+	[UART_FLOW_CONTROL_RTS_CTS] = AM_HAL_UART_FLOW_CTRL_RTS_CTS,
+	[UART_FLOW_CONTROL_RTS] = AM_HAL_UART_FLOW_CTRL_RTS_ONLY,
+	[UART_FLOW_CONTROL_CTS] = AM_HAL_UART_FLOW_CTRL_CTS_ONLY,
+};
+
+static const uint32_t tx_fifo_levels[] = {
+	[UART_FIFO_1_8] = AM_HAL_UART_TX_FIFO_1_8,
+	[UART_FIFO_1_4] = AM_HAL_UART_TX_FIFO_1_4,
+	[UART_FIFO_1_2] = AM_HAL_UART_TX_FIFO_1_2,
+	[UART_FIFO_3_4] = AM_HAL_UART_TX_FIFO_3_4,
+	[UART_FIFO_7_8] = AM_HAL_UART_TX_FIFO_7_8,
+};
+
+static const uint32_t rx_fifo_levels[] = {
+	[UART_FIFO_1_8] = AM_HAL_UART_RX_FIFO_1_8,
+	[UART_FIFO_1_4] = AM_HAL_UART_RX_FIFO_1_4,
+	[UART_FIFO_1_2] = AM_HAL_UART_RX_FIFO_1_2,
+	[UART_FIFO_3_4] = AM_HAL_UART_RX_FIFO_3_4,
+	[UART_FIFO_7_8] = AM_HAL_UART_RX_FIFO_7_8,
+};
+
+#define UART_RX_INTERRUPTS (AM_HAL_UART_INT_RX | AM_HAL_UART_INT_RX_TMOUT)
+#define UART_ERROR_INTERRUPTS                                                  \
+	(AM_HAL_UART_INT_OVER_RUN | AM_HAL_UART_INT_FRAME_ERR |                    \
+	 AM_HAL_UART_INT_PARITY_ERROR | AM_HAL_UART_INT_BREAK_ERR)
+
+static uint32_t
+uart_configure(struct uart *uart, const struct uart_config *config)
+{
+	if ((size_t)config->parity >= sizeof(parities) / sizeof(*parities) ||
+		(size_t)config->flow_control >=
+			sizeof(flow_controls) / sizeof(*flow_controls) ||
+		(size_t)config->tx_fifo_level >=
+			sizeof(tx_fifo_levels) / sizeof(*tx_fifo_levels) ||
+		(size_t)config->rx_fifo_level >=
+			sizeof(rx_fifo_levels) / sizeof(*rx_fifo_levels))
+		return AM_HAL_STATUS_INVALID_ARG;
+
+	const am_hal_uart_config_t hal_config = {
+		.ui32BaudRate = config->baud_rate,
+		.ui32DataBits = AM_HAL_UART_DATA_BITS_8,
+		.ui32Parity = parities[config->parity],
+		.ui32StopBits = config->two_stop_bits ? AM_HAL_UART_TWO_STOP_BITS
+											  : AM_HAL_UART_ONE_STOP_BIT,
+		.ui32FlowControl = flow_controls[config->flow_control],
+		.ui32FifoLevels = tx_fifo_levels[config->tx_fifo_level] |
+			rx_fifo_levels[config->rx_fifo_level],
+
+		// Buffers. RX is handled by our own ISR, so the HAL doesn't get an RX
+		// queue, see uart_isr_handler.
+		.pui8TxBuffer = uart->tx_buffer,
+		.ui32TxBufferSize = uart->tx_size,
+		.pui8RxBuffer = NULL,
+		.ui32RxBufferSize = 0,
+	};
+	uint32_t status = am_hal_uart_configure(uart->handle, &hal_config);
+	if (status != AM_HAL_STATUS_SUCCESS)
+		return status;
+	uart->config = *config;
+	// RX fires at the FIFO threshold, RX timeout when fewer bytes than that
+	// have been sitting in the FIFO for a while
+	uint32_t interrupts = UART_ERROR_INTERRUPTS;
+	if (!atomic_load(&uart->rx_paused))
+		interrupts |= UART_RX_INTERRUPTS;
+	CHECK_ERRORS(am_hal_uart_interrupt_enable(uart->handle, interrupts));
+	return AM_HAL_STATUS_SUCCESS;
+}
+
+// Uses the given buffer, or allocates one of the given size (or the default
+// size) if there is none
+static uint8_t *uart_buffer(
+	uint8_t *buffer, size_t *size, size_t default_size, bool *allocated
+)
+{
+	*allocated = false;
+	if (!*size)
+		*size = default_size;
+	if (buffer)
+		return buffer;
+	*allocated = true;
+	return malloc(*size);
+}
+
+static void uart_free_buffers(struct uart *uart)
+{
+	if (uart->tx_allocated)
+		free(uart->tx_buffer);
+	if (uart->rx_allocated)
+		free(uart->rx_buffer);
+}
+
+struct uart *uart_get_instance(
+	enum uart_instance instance, const struct uart_buffers *buffers
+)
 {
 	struct uart *uart = uarts + (int)instance;
 	if (!uart->handle)
 	{
-		const am_hal_uart_config_t config = {
-			// Standard UART settings: 115200-8-N-1
-			.ui32BaudRate = 115200,
-			.ui32DataBits = AM_HAL_UART_DATA_BITS_8,
-			.ui32Parity = AM_HAL_UART_PARITY_NONE,
-			.ui32StopBits = AM_HAL_UART_ONE_STOP_BIT,
-			.ui32FlowControl = AM_HAL_UART_FLOW_CTRL_NONE,
-
-			// Set TX and RX FIFOs to interrupt at half-full.
-			.ui32FifoLevels =
-				(AM_HAL_UART_TX_FIFO_1_2 | AM_HAL_UART_RX_FIFO_1_2),
-
-			// Buffers
-			.pui8TxBuffer = uart->tx_buffer,
-			.ui32TxBufferSize = sizeof(uart->tx_buffer),
-			.pui8RxBuffer = uart->rx_buffer,
-			.ui32RxBufferSize = sizeof(uart->rx_buffer),
-		};
-		static_assert(
-			sizeof(uart->tx_buffer) == 1024, "unexpected tx_buffer size"
+		const struct uart_buffers defaults = {0};
+		if (!buffers)
+			buffers = &defaults;
+		uart->tx_size = buffers->tx_size;
+		uart->tx_buffer = uart_buffer(
+			buffers->tx,
+			&uart->tx_size,
+			UART_DEFAULT_TX_BUFFER_SIZE,
+			&uart->tx_allocated
 		);
-		static_assert(
-			sizeof(uart->rx_buffer) == 1024, "unexpected rx_buffer size"
+		uart->rx_size = buffers->rx_size;
+		uart->rx_buffer = uart_buffer(
+			buffers->rx,
+			&uart->rx_size,
+			UART_DEFAULT_RX_BUFFER_SIZE,
+			&uart->rx_allocated
 		);
+		// The RX ring always leaves one byte empty
+		if (!uart->tx_buffer || !uart->rx_buffer || uart->rx_size < 2)
+		{
+			uart_free_buffers(uart);
+			memset(uart, 0, sizeof(*uart));
+			return NULL;
+		}
 
 		uart->instance = (int)instance;
+		uart->pins = default_pins[(int)instance];
+		uart->rx_head = 0;
+		uart->rx_tail = 0;
 		CHECK_ERRORS(am_hal_uart_initialize((int)instance, &uart->handle));
 		CHECK_ERRORS(
 			am_hal_uart_power_control(uart->handle, AM_HAL_SYSCTRL_WAKE, false)
 		);
-		CHECK_ERRORS(am_hal_uart_configure(uart->handle, &config));
+		uart->rx_paused = false;
+		memset(&uart->errors, 0, sizeof(uart->errors));
+		CHECK_ERRORS(uart_configure(uart, &default_config));
 
 		uart_sleep(uart);
 	}
@@ -101,8 +272,7 @@ bool uart_sleep(struct uart *uart)
 	}
 	while (status == AM_HAL_STATUS_IN_USE);
 
-	am_hal_gpio_pinconfig(AM_BSP_GPIO_COM_UART_TX, g_AM_HAL_GPIO_DISABLE);
-	am_hal_gpio_pinconfig(AM_BSP_GPIO_COM_UART_RX, g_AM_HAL_GPIO_DISABLE);
+	uart_pins_config(&uart->pins, false);
 	NVIC_DisableIRQ((IRQn_Type)(UART0_IRQn + uart->instance));
 	return true;
 }
@@ -118,8 +288,7 @@ bool uart_enable(struct uart *uart)
 		return false;
 	}
 
-	am_hal_gpio_pinconfig(AM_BSP_GPIO_COM_UART_TX, g_AM_BSP_GPIO_COM_UART_TX);
-	am_hal_gpio_pinconfig(AM_BSP_GPIO_COM_UART_RX, g_AM_BSP_GPIO_COM_UART_RX);
+	uart_pins_config(&uart->pins, true);
 	NVIC_EnableIRQ((IRQn_Type)(UART0_IRQn + uart->instance));
 	return true;
 }
@@ -131,16 +300,12 @@ void uart_deinitialize(struct uart *uart)
 		if (!--(uart->refcount))
 		{
 			NVIC_DisableIRQ((IRQn_Type)(UART0_IRQn + uart->instance));
-			am_hal_gpio_pinconfig(
-				AM_BSP_GPIO_COM_UART_RX, g_AM_HAL_GPIO_DISABLE
-			);
-			am_hal_gpio_pinconfig(
-				AM_BSP_GPIO_COM_UART_TX, g_AM_HAL_GPIO_DISABLE
-			);
+			uart_pins_config(&uart->pins, false);
 			am_hal_uart_power_control(
 				uart->handle, AM_HAL_SYSCTRL_DEEPSLEEP, false
 			);
 			am_hal_uart_deinitialize(uart->handle);
+			uart_free_buffers(uart);
 			memset(uart, 0, sizeof(*uart));
 		}
 	}
@@ -161,41 +326,160 @@ size_t uart_write(struct uart *uart, const unsigned char *data, size_t size)
 	return written;
 }
 
+size_t
+uart_write_all(struct uart *uart, const unsigned char *data, size_t size)
+{
+	size_t written = uart_write(uart, data, size);
+	size_t waits = 0;
+	while (written < size)
+	{
+		// Interrupts are masked so the TX interrupt can't drain the buffer
+		// between the write and the sleep, a pending interrupt still wakes
+		// the processor up
+		uint32_t state = am_hal_interrupt_master_disable();
+		size_t chunk = uart_write(uart, data + written, size - written);
+		if (!chunk)
+		{
+			am_hal_sysctrl_sleep(AM_HAL_SYSCTRL_SLEEP_NORMAL);
+			waits += 1;
+		}
+		am_hal_interrupt_master_set(state);
+		written += chunk;
+	}
+	return waits;
+}
+
+size_t uart_rx_available(struct uart *uart)
+{
+	const size_t size = uart->rx_size;
+	unsigned head = atomic_load(&uart->rx_head);
+	unsigned tail = atomic_load(&uart->rx_tail);
+	return (head + size - tail) % size;
+}
+
 size_t uart_read(struct uart *uart, unsigned char *data, size_t size)
 {
-	uint32_t read = 0;
-	const am_hal_uart_transfer_t config = {
-		.ui32Direction = AM_HAL_UART_READ,
-		.pui8Data = (uint8_t *)data,
-		.ui32NumBytes = size,
-		.ui32TimeoutMs = 0,
-		.pui32BytesTransferred = &read,
-	};
+	const size_t buffer_size = uart->rx_size;
+	unsigned head = atomic_load(&uart->rx_head);
+	unsigned tail = atomic_load(&uart->rx_tail);
+	size_t read = 0;
+	while (read < size && tail != head)
+	{
+		data[read++] = uart->rx_buffer[tail];
+		tail = (tail + 1) % buffer_size;
+	}
+	atomic_store(&uart->rx_tail, tail);
 
-	CHECK_ERRORS(am_hal_uart_transfer(uart->handle, &config));
+	// The ISR stopped emptying the FIFO when the buffer filled up, now that
+	// there's room let it continue
+	if (read && atomic_exchange(&uart->rx_paused, false))
+	{
+		uint32_t state = am_hal_interrupt_master_disable();
+		am_hal_uart_interrupt_enable(uart->handle, UART_RX_INTERRUPTS);
+		am_hal_interrupt_master_set(state);
+	}
 	return read;
 }
 
-void uart_set_baud_rate(struct uart *uart, unsigned int baud_rate)
+size_t uart_read_timeout(
+	struct uart *uart, unsigned char *data, size_t size, uint32_t timeout_ms
+)
 {
-	const am_hal_uart_config_t config = {
-		// Standard UART settings: 115200-8-N-1
-		.ui32BaudRate = baud_rate,
-		.ui32DataBits = AM_HAL_UART_DATA_BITS_8,
-		.ui32Parity = AM_HAL_UART_PARITY_NONE,
-		.ui32StopBits = AM_HAL_UART_ONE_STOP_BIT,
-		.ui32FlowControl = AM_HAL_UART_FLOW_CTRL_NONE,
+	if (!size)
+		return 0;
 
-		// Set TX and RX FIFOs to interrupt at half-full.
-		.ui32FifoLevels = (AM_HAL_UART_TX_FIFO_1_2 | AM_HAL_UART_RX_FIFO_1_2),
+	// The systick interrupt wakes us up every millisecond, which is what
+	// lets us notice the timeout while asleep
+	const bool timed = timeout_ms != UART_TIMEOUT_FOREVER;
+	const bool ticking = systick_started();
+	const uint64_t start = ticking ? systick_jiffies() : 0;
+	uint32_t waited = 0;
+	for (;;)
+	{
+		size_t read = uart_read(uart, data, size);
+		if (read)
+			return read;
 
-		// Buffers
-		.pui8TxBuffer = uart->tx_buffer,
-		.ui32TxBufferSize = sizeof(uart->tx_buffer),
-		.pui8RxBuffer = uart->rx_buffer,
-		.ui32RxBufferSize = sizeof(uart->rx_buffer),
-	};
-	CHECK_ERRORS(am_hal_uart_configure(uart->handle, &config));
+		if (timed)
+		{
+			if (ticking)
+				waited = systick_jiffies() - start;
+			if (waited >= timeout_ms)
+				return 0;
+			// Nothing will wake us up on time, so poll instead
+			if (!ticking)
+			{
+				am_util_delay_ms(1);
+				waited += 1;
+				continue;
+			}
+		}
+
+		// Same as in mspi.c, interrupts are masked while we check so that data
+		// can't arrive between the check and the sleep. Deep sleep stops the
+		// clock the UART runs from, so only use normal sleep.
+		uint32_t state = am_hal_interrupt_master_disable();
+		if (!uart_rx_available(uart))
+			am_hal_sysctrl_sleep(AM_HAL_SYSCTRL_SLEEP_NORMAL);
+		am_hal_interrupt_master_set(state);
+	}
+}
+
+bool uart_set_config(struct uart *uart, const struct uart_config *config)
+{
+	// Reconfiguring drops whatever is still queued, so let it go out with the
+	// old settings first
+	uart_sync(uart);
+	if (uart_configure(uart, config) != AM_HAL_STATUS_SUCCESS)
+	{
+		// The HAL rejects rates the UART clock can't produce, put the old
+		// settings back
+		CHECK_ERRORS(uart_configure(uart, &uart->config));
+		return false;
+	}
+	return true;
+}
+
+void uart_get_config(struct uart *uart, struct uart_config *config)
+{
+	*config = uart->config;
+}
+
+bool uart_set_baud_rate(struct uart *uart, unsigned int baud_rate)
+{
+	struct uart_config config = uart->config;
+	config.baud_rate = baud_rate;
+	return uart_set_config(uart, &config);
+}
+
+unsigned int uart_get_baud_rate(struct uart *uart)
+{
+	return uart->config.baud_rate;
+}
+
+void uart_set_pins(struct uart *uart, const struct uart_pins *pins)
+{
+	uart->pins = *pins;
+}
+
+void uart_get_pins(struct uart *uart, struct uart_pins *pins)
+{
+	*pins = uart->pins;
+}
+
+void uart_get_error_stats(struct uart *uart, struct uart_error_stats *stats)
+{
+	*stats = uart->errors;
+}
+
+size_t uart_tx_buffer_size(struct uart *uart)
+{
+	return uart->tx_size;
+}
+
+size_t uart_rx_buffer_size(struct uart *uart)
+{
+	return uart->rx_size;
 }
 
 void uart_sync(struct uart *uart)
@@ -203,12 +487,66 @@ void uart_sync(struct uart *uart)
 	am_hal_uart_tx_flush(uart->handle);
 }
 
+// Moves the RX FIFO into the RX ring buffer. If the buffer fills up, data is
+// left in the FIFO and the RX interrupts are disabled until uart_read makes
+// room, so with flow control RTS tells the other end to stop, and without it
+// the FIFO overruns and the loss is counted.
+static void uart_rx_drain(struct uart *uart)
+{
+	const size_t size = uart->rx_size;
+	uint8_t data[32];
+	uint32_t read;
+	do
+	{
+		unsigned head = atomic_load(&uart->rx_head);
+		unsigned tail = atomic_load(&uart->rx_tail);
+		size_t space = (tail + size - head - 1) % size;
+		if (!space)
+		{
+			atomic_store(&uart->rx_paused, true);
+			am_hal_uart_interrupt_disable(uart->handle, UART_RX_INTERRUPTS);
+			return;
+		}
+
+		read = 0;
+		const am_hal_uart_transfer_t config = {
+			.ui32Direction = AM_HAL_UART_READ,
+			.pui8Data = data,
+			.ui32NumBytes = space < sizeof(data) ? space : sizeof(data),
+			.ui32TimeoutMs = 0,
+			.pui32BytesTransferred = &read,
+		};
+		// Without an RX queue the HAL reads straight from the FIFO
+		am_hal_uart_transfer(uart->handle, &config);
+
+		for (uint32_t i = 0; i < read; ++i)
+		{
+			uart->rx_buffer[head] = data[i];
+			head = (head + 1) % size;
+		}
+		atomic_store(&uart->rx_head, head);
+	}
+	while (read == sizeof(data));
+}
+
 static void uart_isr_handler(struct uart *uart)
 {
 	uint32_t status;
 	am_hal_uart_interrupt_status_get(uart->handle, &status, true);
 	am_hal_uart_interrupt_clear(uart->handle, status);
 
+	if (status & AM_HAL_UART_INT_OVER_RUN)
+		uart->errors.overruns += 1;
+	if (status & AM_HAL_UART_INT_FRAME_ERR)
+		uart->errors.framing_errors += 1;
+	if (status & AM_HAL_UART_INT_PARITY_ERROR)
+		uart->errors.parity_errors += 1;
+	if (status & AM_HAL_UART_INT_BREAK_ERR)
+		uart->errors.breaks += 1;
+
+	if (status & UART_RX_INTERRUPTS)
+		uart_rx_drain(uart);
+
 	uint32_t idle;
 	am_hal_uart_interrupt_service(uart->handle, status, &idle);
 }